@@ -8,3 +8,28 @@
 extern inline uint64_t clkutils_read_mtime();
 extern inline uint64_t clkutils_read_mcycle();
 extern inline void clkutils_delay_ns(int delay_ns);
+extern inline uint64_t clkutils_deadline_ns(int delay_ns);
+extern inline int clkutils_deadline_passed(uint64_t deadline);
+extern inline void clkutils_deadline_wait(uint64_t deadline);
+
+// RTC ticks clkutils_calibrate() counts cycles over
+#define CLKUTILS_CALIBRATE_TICKS 200
+
+uint32_t clkutils_core_khz;
+
+uint32_t clkutils_calibrate(void)
+{
+  uint64_t start, end, cycles;
+
+  // Start and stop on a tick edge so the window is whole ticks
+  start = clkutils_read_mtime();
+  while (clkutils_read_mtime() == start) ;
+  cycles = clkutils_read_mcycle();
+  end = start + 1 + CLKUTILS_CALIBRATE_TICKS;
+  while (clkutils_read_mtime() < end) ;
+  cycles = clkutils_read_mcycle() - cycles;
+
+  // Round up: a clock overestimated by a little only lengthens delays
+  clkutils_core_khz = (cycles * (1000000000UL / RTC_PERIOD_NS) / 1000 + CLKUTILS_CALIBRATE_TICKS - 1) / CLKUTILS_CALIBRATE_TICKS;
+  return clkutils_core_khz;
+}
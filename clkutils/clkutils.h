@@ -33,7 +33,7 @@ inline uint64_t clkutils_read_mtime(void) {
 #endif
 }
 
-inline static uint64_t clkutils_read_mcycle(void) {
+inline uint64_t clkutils_read_mcycle(void) {
 #if __riscv_xlen == 32
   uint32_t mcycle_hi_0;
   uint32_t mcycle_lo;
@@ -50,16 +50,24 @@ inline static uint64_t clkutils_read_mcycle(void) {
 #endif
 }
 
-// Note that since this runs off RTC, which is
-// currently ~1-10MHz, this function is
-// not acccurate for small delays.
-// In the future, we may want to determine whether to
-// use RTC vs mcycle, or create a different function
-// based off mcycle.
-// We add 1 to the then value because otherwise, if you wanted
-// to delay up to RTC_PERIOD_NS-1 (for example), you wouldn't delay
-// at all. So this function delays AT LEAST delay_ns.
+// Core clock in kHz as last measured by clkutils_calibrate(); 0 until then
+extern uint32_t clkutils_core_khz;
+
+// Measure the core clock against mtime, for the mcycle-based delays below.
+// Call it again whenever the core clock changes. Returns the clock in kHz.
+uint32_t clkutils_calibrate(void);
+
+// Delays AT LEAST delay_ns. Once the core clock is calibrated this counts
+// mcycle, so it is accurate to a few cycles; before that it runs off RTC,
+// which is currently ~1-10MHz, and rounds up to the next tick plus one
+// (otherwise a delay of RTC_PERIOD_NS-1 would not delay at all).
 inline void clkutils_delay_ns(int delay_ns) {
+  if (clkutils_core_khz) {
+    uint64_t then = clkutils_read_mcycle() + ((uint64_t) delay_ns * clkutils_core_khz + 999999) / 1000000;
+    while (clkutils_read_mcycle() < then) ;
+    return;
+  }
+
   uint64_t now = clkutils_read_mtime();
   uint64_t then = now + delay_ns / RTC_PERIOD_NS + 1;
 
@@ -69,6 +77,21 @@ inline void clkutils_delay_ns(int delay_ns) {
   while (now < then);
 }
 
+// Deadlines let a step that must wait start other work meanwhile: take a
+// deadline when the wait begins and complete it (or poll it) when the step
+// goes on. They count mtime, so they hold across core clock changes.
+inline uint64_t clkutils_deadline_ns(int delay_ns) {
+  return clkutils_read_mtime() + delay_ns / RTC_PERIOD_NS + 1;
+}
+
+inline int clkutils_deadline_passed(uint64_t deadline) {
+  return clkutils_read_mtime() >= deadline;
+}
+
+inline void clkutils_deadline_wait(uint64_t deadline) {
+  while (!clkutils_deadline_passed(deadline)) ;
+}
+
 #endif /* !__ASSEMBLER__ */
 
 #endif /* _LIBRARIES_CLKUTILS_H */
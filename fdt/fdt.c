@@ -27,21 +27,58 @@ static inline int isstring(char c)
   return 0;
 }
 
-static uint32_t *fdt_scan_helper(
-  uint32_t *lex,
-  const char *strings,
-  struct fdt_scan_node *node,
-  const struct fdt_cb *cb)
+// First token after the name of the node at lex
+static inline uint32_t *fdt_node_props(uint32_t *lex)
 {
-  struct fdt_scan_node child;
+  return lex + 2 + strlen((const char *)(lex+1))/4;
+}
+
+static uint32_t *fdt_next(uint32_t *lex)
+{
+  switch (bswap(lex[0])) {
+    case FDT_BEGIN_NODE: return fdt_node_props(lex);
+    case FDT_PROP:       return lex + 3 + (bswap(lex[1])+3)/4;
+    case FDT_END:        return lex;
+    default:             return lex + 1; // FDT_NOP, FDT_END_NODE
+  }
+}
+
+// Skip from a FDT_BEGIN_NODE to the token after its FDT_END_NODE
+static uint32_t *fdt_skip_node(uint32_t *lex)
+{
+  int depth = 0;
+  do {
+    switch (bswap(lex[0])) {
+      case FDT_BEGIN_NODE: ++depth; break;
+      case FDT_END_NODE:   --depth; break;
+      case FDT_END:        return lex;
+    }
+    lex = fdt_next(lex);
+  } while (depth > 0);
+  return lex;
+}
+
+// One open node on the explicit scan stack
+struct fdt_scan_level {
+  struct fdt_scan_node node;
+  uint32_t *begin; // FDT_BEGIN_NODE token, for deletion by close()
+  int last;        // a child was seen, so done() has already run
+};
+
+int fdt_scan(uintptr_t fdt, const struct fdt_cb *cb)
+{
+  struct fdt_header *header = (struct fdt_header *)fdt;
+  struct fdt_scan_level stack[FDT_SCAN_MAX_DEPTH];
+  struct fdt_scan_level *level = 0; // innermost open node
   struct fdt_scan_prop prop;
-  int last = 0;
+  int depth = 0;
 
-  child.parent = node;
-  // these are the default cell counts, as per the FDT spec
-  child.address_cells = 2;
-  child.size_cells = 1;
-  prop.node = node;
+  // Only process FDT that we understand
+  if (bswap(header->magic) != FDT_MAGIC ||
+      bswap(header->last_comp_version) > FDT_VERSION) return 0;
+
+  const char *strings = (const char *)(fdt + bswap(header->off_dt_strings));
+  uint32_t *lex = (uint32_t *)(fdt + bswap(header->off_dt_struct));
 
   while (1) {
     switch (bswap(lex[0])) {
@@ -50,56 +87,54 @@ static uint32_t *fdt_scan_helper(
         break;
       }
       case FDT_PROP: {
-        // assert (!last);
+        prop.node  = level ? &level->node : 0;
         prop.name  = strings + bswap(lex[2]);
         prop.len   = bswap(lex[1]);
         prop.value = lex + 3;
-        if (node && !strcmp(prop.name, "#address-cells")) { node->address_cells = bswap(lex[3]); }
-        if (node && !strcmp(prop.name, "#size-cells"))    { node->size_cells    = bswap(lex[3]); }
+        if (level && !strcmp(prop.name, "#address-cells")) { level->node.address_cells = bswap(lex[3]); }
+        if (level && !strcmp(prop.name, "#size-cells"))    { level->node.size_cells    = bswap(lex[3]); }
         lex += 3 + (prop.len+3)/4;
-        cb->prop(&prop, cb->extra);
+        if (cb->prop && cb->prop(&prop, cb->extra) == FDT_SCAN_FOUND) return FDT_SCAN_FOUND;
         break;
       }
       case FDT_BEGIN_NODE: {
-        uint32_t *lex_next;
-        if (!last && node && cb->done) cb->done(node, cb->extra);
-        last = 1;
-        child.name = (const char *)(lex+1);
-        if (cb->open) cb->open(&child, cb->extra);
-        lex_next = fdt_scan_helper(
-          lex + 2 + strlen(child.name)/4,
-          strings, &child, cb);
-        if (cb->close && cb->close(&child, cb->extra) == -1)
-          while (lex != lex_next) *lex++ = bswap(FDT_NOP);
-        lex = lex_next;
+        if (level && !level->last) {
+          level->last = 1;
+          if (cb->done && cb->done(&level->node, cb->extra) == FDT_SCAN_FOUND) return FDT_SCAN_FOUND;
+        }
+        if (depth == FDT_SCAN_MAX_DEPTH) return FDT_ERR_DEPTH;
+        level = &stack[depth++];
+        level->node.parent = depth > 1 ? &stack[depth-2].node : 0;
+        level->node.name = (const char *)(lex+1);
+        // these are the default cell counts, as per the FDT spec
+        level->node.address_cells = 2;
+        level->node.size_cells = 1;
+        level->begin = lex;
+        level->last = 0;
+        lex = fdt_node_props(lex);
+        if (cb->open && cb->open(&level->node, cb->extra) == FDT_SCAN_FOUND) return FDT_SCAN_FOUND;
         break;
       }
       case FDT_END_NODE: {
-        if (!last && node && cb->done) cb->done(node, cb->extra);
-        return lex + 1;
+        int rc = 0;
+        lex += 1;
+        if (!level) return 0; // unbalanced
+        if (!level->last && cb->done && cb->done(&level->node, cb->extra) == FDT_SCAN_FOUND) return FDT_SCAN_FOUND;
+        if (cb->close) rc = cb->close(&level->node, cb->extra);
+        if (rc == -1)
+          while (level->begin != lex) *level->begin++ = bswap(FDT_NOP);
+        else if (rc == FDT_SCAN_FOUND)
+          return FDT_SCAN_FOUND;
+        level = --depth ? &stack[depth-1] : 0;
+        break;
       }
       default: { // FDT_END
-        if (!last && node && cb->done) cb->done(node, cb->extra);
-        return lex;
+        return 0;
       }
     }
   }
 }
 
-void fdt_scan(uintptr_t fdt, const struct fdt_cb *cb)
-{
-  struct fdt_header *header = (struct fdt_header *)fdt;
-
-  // Only process FDT that we understand
-  if (bswap(header->magic) != FDT_MAGIC ||
-      bswap(header->last_comp_version) > FDT_VERSION) return;
-
-  const char *strings = (const char *)(fdt + bswap(header->off_dt_strings));
-  uint32_t *lex = (uint32_t *)(fdt + bswap(header->off_dt_struct));
-
-  fdt_scan_helper(lex, strings, 0, cb);
-}
-
 uint32_t fdt_size(uintptr_t fdt)
 {
   struct fdt_header *header = (struct fdt_header *)fdt;
@@ -156,13 +191,14 @@ struct mem_scan {
   int reg_len;
 };
 
-static void mem_open(const struct fdt_scan_node *node, void *extra)
+static int mem_open(const struct fdt_scan_node *node, void *extra)
 {
   struct mem_scan *scan = (struct mem_scan *)extra;
   scan->memory = 0;
+  return 0;
 }
 
-static void mem_prop(const struct fdt_scan_prop *prop, void *extra)
+static int mem_prop(const struct fdt_scan_prop *prop, void *extra)
 {
   struct mem_scan *scan = (struct mem_scan *)extra;
   if (!strcmp(prop->name, "device_type") && !strcmp((const char*)prop->value, "memory")) {
@@ -171,16 +207,17 @@ static void mem_prop(const struct fdt_scan_prop *prop, void *extra)
     scan->reg_value = prop->value;
     scan->reg_len = prop->len;
   }
+  return 0;
 }
 
-static void mem_done(const struct fdt_scan_node *node, void *extra)
+static int mem_done(const struct fdt_scan_node *node, void *extra)
 {
   struct mem_scan *scan = (struct mem_scan *)extra;
   const uint32_t *value = scan->reg_value;
   const uint32_t *end = value + scan->reg_len/4;
   uint32_t *size_ptr;
 
-  if (!scan->memory) return;
+  if (!scan->memory) return 0;
   // assert (scan->reg_value && scan->reg_len % 4 == 0);
 
   while (end - value > 0) {
@@ -196,9 +233,10 @@ static void mem_done(const struct fdt_scan_node *node, void *extra)
     }
   }
   // assert (end == value);
+  return 0;
 }
 
-void fdt_reduce_mem(uintptr_t fdt, uintptr_t size)
+int fdt_reduce_mem(uintptr_t fdt, uintptr_t size)
 {
   struct fdt_cb cb;
   struct mem_scan scan;
@@ -210,34 +248,976 @@ void fdt_reduce_mem(uintptr_t fdt, uintptr_t size)
   cb.extra = &scan;
   scan.size = size;
 
-  fdt_scan(fdt, &cb);
+  return fdt_scan(fdt, &cb) == FDT_ERR_DEPTH ? FDT_ERR_DEPTH : 0;
 }
 
-//////////////////////////////////////////// MAC ADDRESS SET ///////////////////////////////////////
+//////////////////////////////////////////// PROPERTY PATCH //////////////////////////////////////
 
-struct prop_scan {
-  const char *prop;
-  uint8_t *value;
+// Compare a NUL terminated node name against the path component [c, end)
+static int fdt_name_eq(const char *name, const char *c, const char *end)
+{
+  for (; c != end; ++c, ++name)
+    if (*c != *name) return 0;
+  return *name == 0;
+}
+
+int fdt_node_is(const struct fdt_scan_node *node, const char *path)
+{
+  const char *end = path + strlen(path);
+
+  // Ignore a trailing '/', but keep "/" itself
+  while (end - path > 1 && end[-1] == '/') --end;
+
+  // Match the path from its last component back up through the parents
+  for (; node && node->parent; node = node->parent) {
+    const char *start = end;
+    while (start > path && start[-1] != '/') --start;
+    if (start == path) return 0; // relative path
+    if (!fdt_name_eq(node->name, start, end)) return 0;
+    end = start - 1;
+  }
+
+  // Only the root may remain, and only the leading '/' of the path with it
+  return node && end - path <= 1 && *path == '/';
+}
+
+#define FDT_PATCH_HASH 16
+
+struct patch_scan {
+  const struct fdt_patch *patches;
+  int8_t head[FDT_PATCH_HASH];
+  int8_t next[FDT_PATCH_MAX];
+  int written;
+  int pending; // path patches left to apply; -1 => some patch targets every node
 };
 
-static void set_prop(const struct fdt_scan_prop *prop, void *extra)
+static inline unsigned int patch_hash(const char *name)
+{
+  unsigned int hash = 5381;
+  while (*name) hash = (hash * 33) ^ (unsigned char)*name++;
+  return hash & (FDT_PATCH_HASH-1);
+}
+
+static void patch_init(struct patch_scan *scan, const struct fdt_patch *patches, int n)
+{
+  memset(scan->head, -1, sizeof(scan->head));
+  scan->patches = patches;
+  scan->written = 0;
+  scan->pending = n;
+  // Insert back to front so that a later patch of the same property wins
+  while (n-- > 0) {
+    unsigned int hash = patch_hash(patches[n].prop);
+    if (!patches[n].path) scan->pending = -1;
+    scan->next[n] = scan->head[hash];
+    scan->head[hash] = n;
+  }
+}
+
+static int patch_prop(const struct fdt_scan_prop *prop, void *extra)
 {
-  struct prop_scan *scan = (struct prop_scan *)extra;
-  if (!strcmp(prop->name, scan->prop)) {
-    memcpy(prop->value, scan->value, prop->len);
+  struct patch_scan *scan = (struct patch_scan *)extra;
+  int i;
+
+  for (i = scan->head[patch_hash(prop->name)]; i >= 0; i = scan->next[i]) {
+    const struct fdt_patch *patch = &scan->patches[i];
+    int len = prop->len;
+    if (strcmp(prop->name, patch->prop)) continue;
+    if (patch->path && !fdt_node_is(prop->node, patch->path)) continue;
+    if (patch->len >= 0 && patch->len < len) len = patch->len;
+    memcpy(prop->value, patch->value, len);
+    scan->written++;
+    if (patch->path) scan->pending--;
   }
+
+  // Every patch named its node and has been applied
+  return scan->pending == 0 ? FDT_SCAN_FOUND : 0;
+}
+
+int fdt_set_props(uintptr_t fdt, const struct fdt_patch *patches, int count)
+{
+  struct fdt_cb cb;
+  struct patch_scan scan;
+  int written = 0, err;
+
+  memset(&cb, 0, sizeof(cb));
+  cb.prop = patch_prop;
+  cb.extra = &scan;
+
+  // More than FDT_PATCH_MAX patches costs one extra scan per FDT_PATCH_MAX
+  for (; count > 0; patches += FDT_PATCH_MAX, count -= FDT_PATCH_MAX) {
+    patch_init(&scan, patches, count < FDT_PATCH_MAX ? count : FDT_PATCH_MAX);
+    if ((err = fdt_scan(fdt, &cb)) == FDT_ERR_DEPTH) return err;
+    written += scan.written;
+  }
+
+  return written;
 }
 
 void fdt_set_prop(uintptr_t fdt, const char *prop, uint8_t* value)
+{
+  struct fdt_patch patch;
+
+  patch.path = 0;
+  patch.prop = prop;
+  patch.value = value;
+  patch.len = -1;
+
+  fdt_set_props(fdt, &patch, 1);
+}
+
+//////////////////////////////////////////// PROPERTY LOOKUP /////////////////////////////////////
+
+struct get_scan {
+  const char *path;
+  const char *prop;
+  uint32_t *value;
+  int len;
+};
+
+static int get_prop(const struct fdt_scan_prop *prop, void *extra)
+{
+  struct get_scan *scan = (struct get_scan *)extra;
+  if (strcmp(prop->name, scan->prop) || !fdt_node_is(prop->node, scan->path)) return 0;
+  scan->value = prop->value;
+  scan->len = prop->len;
+  return FDT_SCAN_FOUND;
+}
+
+uint32_t *fdt_get_prop(uintptr_t fdt, const char *path, const char *prop, int *len)
 {
   struct fdt_cb cb;
-  struct prop_scan scan;
+  struct get_scan scan;
 
   memset(&cb, 0, sizeof(cb));
-  cb.prop = set_prop;
+  cb.prop = get_prop;
   cb.extra = &scan;
-  scan.value = value;
+  scan.path = path;
   scan.prop = prop;
+  scan.value = 0;
+  scan.len = 0;
 
   fdt_scan(fdt, &cb);
+  if (len) *len = scan.len;
+  return scan.value;
+}
+
+//////////////////////////////////////////// STRUCTURE EDIT ////////////////////////////////////////
+
+#define FDT_ALIGN(x) (((x) + 3) & ~3)
+
+static inline void fdt_add32(uint32_t *field, int32_t delta)
+{
+  *field = bswap(bswap(*field) + delta);
+}
+
+// Editing needs the v17 size fields and the usual rsvmap, struct, strings order
+static int fdt_check_edit(uintptr_t fdt)
+{
+  struct fdt_header *header = (struct fdt_header *)fdt;
+
+  if (bswap(header->magic) != FDT_MAGIC ||
+      bswap(header->version) < 17 ||
+      bswap(header->last_comp_version) > FDT_VERSION) return FDT_ERR_BADFDT;
+  if (bswap(header->off_mem_rsvmap) > bswap(header->off_dt_struct) ||
+      bswap(header->off_dt_struct) + bswap(header->size_dt_struct) > bswap(header->off_dt_strings) ||
+      bswap(header->off_dt_strings) + bswap(header->size_dt_strings) > bswap(header->totalsize))
+    return FDT_ERR_BADFDT;
+  return 0;
+}
+
+// FDT_BEGIN_NODE token of the node at an absolute path, or 0
+static uint32_t *fdt_find_node(uintptr_t fdt, const char *path)
+{
+  struct fdt_header *header = (struct fdt_header *)fdt;
+  uint32_t *lex = (uint32_t *)(fdt + bswap(header->off_dt_struct));
+
+  while (bswap(*lex) == FDT_NOP) ++lex;
+  if (bswap(*lex) != FDT_BEGIN_NODE || *path != '/') return 0;
+
+  while (1) {
+    const char *end;
+    while (*path == '/') ++path;
+    if (!*path) return lex;
+    for (end = path; *end && *end != '/'; ++end) ;
+
+    // Find the child named by this path component
+    lex = fdt_node_props(lex);
+    while (1) {
+      uint32_t token = bswap(*lex);
+      if (token == FDT_BEGIN_NODE) {
+        if (fdt_name_eq((const char *)(lex+1), path, end)) break;
+        lex = fdt_skip_node(lex);
+      } else if (token == FDT_END_NODE || token == FDT_END) {
+        return 0;
+      } else {
+        lex = fdt_next(lex);
+      }
+    }
+    path = end;
+  }
+}
+
+// Resize [at, at+oldlen) to newlen bytes, moving the rest of the blob behind it.
+// The caller adjusts the size of the block being edited.
+static int fdt_splice(uintptr_t fdt, uint32_t bufsize, void *at, uint32_t oldlen, uint32_t newlen)
+{
+  struct fdt_header *header = (struct fdt_header *)fdt;
+  uint32_t total = bswap(header->totalsize);
+  uint32_t off = (uintptr_t)at - fdt;
+  int32_t delta = (int32_t)newlen - (int32_t)oldlen;
+
+  if (total + delta > bufsize) return FDT_ERR_NOSPACE;
+  memmove((char *)at + newlen, (char *)at + oldlen, total - off - oldlen);
+
+  fdt_add32(&header->totalsize, delta);
+  if (bswap(header->off_dt_struct)  > off) fdt_add32(&header->off_dt_struct,  delta);
+  if (bswap(header->off_dt_strings) > off) fdt_add32(&header->off_dt_strings, delta);
+  return 0;
+}
+
+// Offset of str in the strings block, appending it when missing
+static int fdt_add_string(uintptr_t fdt, uint32_t bufsize, const char *str)
+{
+  struct fdt_header *header = (struct fdt_header *)fdt;
+  char *strings = (char *)(fdt + bswap(header->off_dt_strings));
+  uint32_t size = bswap(header->size_dt_strings);
+  uint32_t len = strlen(str) + 1;
+  uint32_t off;
+  int err;
+
+  for (off = 0; off < size; off += strlen(strings + off) + 1)
+    if (!strcmp(strings + off, str)) return off;
+
+  if ((err = fdt_splice(fdt, bufsize, strings + size, 0, len))) return err;
+  memcpy(strings + size, str, len);
+  fdt_add32(&header->size_dt_strings, len);
+  return size;
+}
+
+// Edits land after a node's FDT_BEGIN_NODE token, so the offsets of that
+// node and its ancestors stay valid across them; the *_at editors work on
+// those offsets to spare a path lookup per edit.
+
+// As fdt_setprop(), on the node at node_off
+static int fdt_setprop_at(uintptr_t fdt, uint32_t bufsize, uint32_t node_off, const char *prop, const void *value, int len)
+{
+  struct fdt_header *header = (struct fdt_header *)fdt;
+  uint32_t *lex;
+  const char *strings;
+  int nameoff, err;
+
+  // Appending to the strings block leaves the struct block in place
+  if ((nameoff = fdt_add_string(fdt, bufsize, prop)) < 0) return nameoff;
+  strings = (const char *)(fdt + bswap(header->off_dt_strings));
+
+  // Properties precede the first child, so stop at either kind of node token
+  lex = fdt_node_props((uint32_t *)(fdt + node_off));
+  while (1) {
+    uint32_t token = bswap(*lex);
+    if (token == FDT_PROP && !strcmp(strings + bswap(lex[2]), prop)) {
+      uint32_t oldlen = FDT_ALIGN(bswap(lex[1]));
+      if ((err = fdt_splice(fdt, bufsize, lex + 3, oldlen, FDT_ALIGN(len)))) return err;
+      fdt_add32(&header->size_dt_struct, FDT_ALIGN(len) - oldlen);
+      break;
+    }
+    if (token != FDT_PROP && token != FDT_NOP) {
+      if ((err = fdt_splice(fdt, bufsize, lex, 0, 12 + FDT_ALIGN(len)))) return err;
+      fdt_add32(&header->size_dt_struct, 12 + FDT_ALIGN(len));
+      lex[0] = bswap(FDT_PROP);
+      lex[2] = bswap(nameoff);
+      break;
+    }
+    lex = fdt_next(lex);
+  }
+
+  lex[1] = bswap(len);
+  memcpy(lex + 3, value, len);
+  memset((char *)(lex + 3) + len, 0, FDT_ALIGN(len) - len);
+  return 0;
+}
+
+int fdt_setprop(uintptr_t fdt, uint32_t bufsize, const char *path, const char *prop, const void *value, int len)
+{
+  uint32_t *lex;
+  int err;
+
+  if ((err = fdt_check_edit(fdt))) return err;
+  if (!(lex = fdt_find_node(fdt, path))) return FDT_ERR_NOTFOUND;
+  return fdt_setprop_at(fdt, bufsize, (uintptr_t)lex - fdt, prop, value, len);
+}
+
+// As fdt_add_node(), under the node at parent_off; *child_off is set to the
+// new node or, with FDT_ERR_EXISTS, the existing one
+static int fdt_add_node_at(uintptr_t fdt, uint32_t bufsize, uint32_t parent_off, const char *name, uint32_t *child_off)
+{
+  struct fdt_header *header = (struct fdt_header *)fdt;
+  uint32_t namelen = strlen(name);
+  uint32_t size = 8 + FDT_ALIGN(namelen + 1);
+  uint32_t *lex;
+  int err;
+
+  // New nodes go last, right before the parent's FDT_END_NODE
+  lex = fdt_node_props((uint32_t *)(fdt + parent_off));
+  while (bswap(*lex) != FDT_END_NODE) {
+    switch (bswap(*lex)) {
+      case FDT_BEGIN_NODE:
+        if (fdt_name_eq((const char *)(lex+1), name, name + namelen)) {
+          *child_off = (uintptr_t)lex - fdt;
+          return FDT_ERR_EXISTS;
+        }
+        lex = fdt_skip_node(lex);
+        break;
+      case FDT_END:
+        return FDT_ERR_BADFDT;
+      default:
+        lex = fdt_next(lex);
+        break;
+    }
+  }
+
+  if ((err = fdt_splice(fdt, bufsize, lex, 0, size))) return err;
+  fdt_add32(&header->size_dt_struct, size);
+  lex[0] = bswap(FDT_BEGIN_NODE);
+  memset(lex + 1, 0, size - 8);
+  memcpy(lex + 1, name, namelen);
+  lex[size/4 - 1] = bswap(FDT_END_NODE);
+  *child_off = (uintptr_t)lex - fdt;
+  return 0;
+}
+
+int fdt_add_node(uintptr_t fdt, uint32_t bufsize, const char *parent, const char *name)
+{
+  uint32_t *lex, child_off;
+  int err;
+
+  if ((err = fdt_check_edit(fdt))) return err;
+  if (!(lex = fdt_find_node(fdt, parent))) return FDT_ERR_NOTFOUND;
+  return fdt_add_node_at(fdt, bufsize, (uintptr_t)lex - fdt, name, &child_off);
+}
+
+//////////////////////////////////////////// STREAMING COPY ////////////////////////////////////////
+
+// The last patch that names this property of this node, or 0
+static const struct fdt_patch *patch_find(const struct patch_scan *scan, const struct fdt_scan_node *node, const char *name)
+{
+  const struct fdt_patch *found = 0;
+  int i;
+
+  for (i = scan->head[patch_hash(name)]; i >= 0; i = scan->next[i]) {
+    const struct fdt_patch *patch = &scan->patches[i];
+    if (strcmp(name, patch->prop)) continue;
+    if (patch->path && !fdt_node_is(node, patch->path)) continue;
+    found = patch;
+  }
+  return found;
+}
+
+int fdt_copy(uintptr_t dst, uint32_t bufsize, uintptr_t src, uint64_t mem_size,
+             const struct fdt_patch *patches, int count)
+{
+  struct fdt_header *in = (struct fdt_header *)src;
+  struct fdt_header *out = (struct fdt_header *)dst;
+  struct fdt_scan_level stack[FDT_SCAN_MAX_DEPTH];
+  struct fdt_scan_level *level = 0;
+  struct fdt_scan_prop prop;
+  struct patch_scan scan;
+  struct mem_scan mem;
+  int depth = 0, err;
+
+  if ((err = fdt_check_edit(src))) return err;
+  if (count > FDT_PATCH_MAX) return FDT_ERR_NOSPACE;
+  patch_init(&scan, patches, count);
+  mem.size = mem_size;
+  mem.reg_value = 0;
+  mem.reg_len = 0;
+
+  const char *strings = (const char *)(src + bswap(in->off_dt_strings));
+  uint32_t strings_size = bswap(in->size_dt_strings);
+
+  // The reservation map ends with an all-zero entry
+  const uint64_t *rsv = (const uint64_t *)(src + bswap(in->off_mem_rsvmap));
+  uint32_t rsv_size = 16;
+  while (rsv[0] || rsv[1]) { rsv += 2; rsv_size += 16; }
+  uint32_t off_rsv = (sizeof(struct fdt_header) + 7) & ~7;
+  uint32_t off_struct = off_rsv + rsv_size;
+  if (off_struct + strings_size > bufsize) return FDT_ERR_NOSPACE;
+  memcpy((void *)(dst + off_rsv), (const void *)(src + bswap(in->off_mem_rsvmap)), rsv_size);
+
+  uint32_t *lex = (uint32_t *)(src + bswap(in->off_dt_struct));
+  uint32_t *o = (uint32_t *)(dst + off_struct);
+  uint32_t *limit = (uint32_t *)(dst + bufsize - strings_size);
+
+  // Tokens go straight from src to dst; NOPs are dropped on the way
+  while (1) {
+    uint32_t *next = fdt_next(lex);
+    switch (bswap(lex[0])) {
+      case FDT_NOP: {
+        break;
+      }
+      case FDT_PROP: {
+        const char *name = strings + bswap(lex[2]);
+        const struct fdt_patch *patch = patch_find(&scan, level ? &level->node : 0, name);
+        const void *value = lex + 3;
+        int len = bswap(lex[1]);
+        if (patch) {
+          value = patch->value;
+          if (patch->len >= 0) len = patch->len;
+          scan.written++;
+        }
+        if (o + 3 + FDT_ALIGN(len)/4 > limit) return FDT_ERR_NOSPACE;
+        o[2 + FDT_ALIGN(len)/4] = 0; // padding, before o[2] in case len is 0
+        o[0] = lex[0];
+        o[1] = bswap(len);
+        o[2] = lex[2];
+        memcpy(o + 3, value, len);
+        if (level && !strcmp(name, "#address-cells")) { level->node.address_cells = bswap(o[3]); }
+        if (level && !strcmp(name, "#size-cells"))    { level->node.size_cells    = bswap(o[3]); }
+        // The memory size is fixed up in dst once the node's properties are all seen
+        prop.node  = level ? &level->node : 0;
+        prop.name  = name;
+        prop.len   = len;
+        prop.value = o + 3;
+        mem_prop(&prop, &mem);
+        o += 3 + FDT_ALIGN(len)/4;
+        break;
+      }
+      case FDT_BEGIN_NODE: {
+        if (level && !level->last) {
+          level->last = 1;
+          mem_done(&level->node, &mem);
+        }
+        if (depth == FDT_SCAN_MAX_DEPTH) return FDT_ERR_DEPTH;
+        if (o + (next - lex) > limit) return FDT_ERR_NOSPACE;
+        memcpy(o, lex, (next - lex) * 4);
+        level = &stack[depth++];
+        level->node.parent = depth > 1 ? &stack[depth-2].node : 0;
+        level->node.name = (const char *)(o+1);
+        level->node.address_cells = 2;
+        level->node.size_cells = 1;
+        level->begin = o;
+        level->last = 0;
+        o += next - lex;
+        mem_open(&level->node, &mem);
+        break;
+      }
+      case FDT_END_NODE: {
+        if (!level) return FDT_ERR_BADFDT;
+        if (!level->last) mem_done(&level->node, &mem);
+        if (o + 1 > limit) return FDT_ERR_NOSPACE;
+        *o++ = lex[0];
+        level = --depth ? &stack[depth-1] : 0;
+        break;
+      }
+      case FDT_END: {
+        if (o + 1 > limit) return FDT_ERR_NOSPACE;
+        *o++ = lex[0];
+        memcpy(o, strings, strings_size);
+        *out = *in;
+        out->off_mem_rsvmap  = bswap(off_rsv);
+        out->off_dt_struct   = bswap(off_struct);
+        out->size_dt_struct  = bswap((uintptr_t)o - dst - off_struct);
+        out->off_dt_strings  = bswap((uintptr_t)o - dst);
+        out->size_dt_strings = bswap(strings_size);
+        out->totalsize       = bswap((uintptr_t)o - dst + strings_size);
+        return scan.written;
+      }
+      default: {
+        return FDT_ERR_BADFDT;
+      }
+    }
+    lex = next;
+  }
+}
+
+//////////////////////////////////////////// PACK ////////////////////////////////////////////////
+
+// Offset of str in the packed strings, appending it when absent
+static int32_t pack_string(char *strings, uint32_t *size, uint32_t limit, const char *str)
+{
+  uint32_t off, len = strlen(str) + 1;
+
+  for (off = 0; off < *size; off += strlen(strings + off) + 1)
+    if (!strcmp(strings + off, str)) return off;
+  if (*size + len > limit) return FDT_ERR_NOSPACE;
+  memcpy(strings + *size, str, len);
+  *size += len;
+  return off;
+}
+
+int fdt_pack(uintptr_t fdt, uint32_t bufsize)
+{
+  struct fdt_header *header = (struct fdt_header *)fdt;
+  uint32_t total, nsize = 0;
+  uint32_t *lex, *start, *w;
+  int32_t off;
+  int err;
+
+  if ((err = fdt_check_edit(fdt))) return err;
+  total = bswap(header->totalsize);
+  if (bufsize < total) return FDT_ERR_NOSPACE;
+
+  // The live strings are collected in the free space past the DTB first,
+  // so running out of room leaves the DTB untouched
+  const char *strings = (const char *)(fdt + bswap(header->off_dt_strings));
+  char *nstrings = (char *)(fdt + total);
+  start = (uint32_t *)(fdt + bswap(header->off_dt_struct));
+  for (lex = start; bswap(*lex) != FDT_END; lex = fdt_next(lex)) {
+    if (bswap(*lex) != FDT_PROP) continue;
+    off = pack_string(nstrings, &nsize, bufsize - total, strings + bswap(lex[2]));
+    if (off < 0) return off;
+  }
+
+  // Slide every token but FDT_NOP down over the holes
+  for (lex = w = start; ; ) {
+    uint32_t token = bswap(*lex);
+    uint32_t *next = token == FDT_END ? lex + 1 : fdt_next(lex);
+    if (token == FDT_PROP)
+      lex[2] = bswap(pack_string(nstrings, &nsize, nsize, strings + bswap(lex[2])));
+    if (token != FDT_NOP) {
+      memmove(w, lex, (next - lex) * 4);
+      w += next - lex;
+    }
+    if (token == FDT_END) break;
+    lex = next;
+  }
+
+  memmove(w, nstrings, nsize);
+  header->size_dt_struct  = bswap((w - start) * 4);
+  header->off_dt_strings  = bswap((uintptr_t)w - fdt);
+  header->size_dt_strings = bswap(nsize);
+  header->totalsize       = bswap((uintptr_t)w - fdt + nsize);
+  return total - bswap(header->totalsize);
+}
+
+//////////////////////////////////////////// PRECOMPUTED LOCATIONS /////////////////////////////////
+
+static inline uint32_t fdt_sum_step(uint32_t sum, uint32_t word)
+{
+  sum = (sum << 5 | sum >> 27) ^ word;
+  return sum * 0x9e3779b1u;
+}
+
+// A trailing partial word is summed as if zero padded
+static uint32_t fdt_sum_tail(uint32_t sum, const uint8_t *tail, uint32_t size)
+{
+  uint32_t word = 0;
+  if (!size) return sum;
+  memcpy(&word, tail, size);
+  return fdt_sum_step(sum, word);
+}
+
+uint32_t fdt_checksum(uintptr_t fdt, uint32_t size)
+{
+  const uint32_t *word = (const uint32_t *)fdt;
+  uint32_t sum = FDT_MAGIC, i;
+
+  for (i = 0; i < size/4; ++i) sum = fdt_sum_step(sum, word[i]);
+  return fdt_sum_tail(sum, (const uint8_t *)(word + i), size & 3);
+}
+
+const struct fdt_locs *fdt_locs_find(uintptr_t fdt)
+{
+  uint32_t size = fdt_size(fdt);
+  const struct fdt_locs *locs = (const struct fdt_locs *)((fdt + size + 7) & ~7UL);
+  if (!size || locs->magic != FDT_LOCS_MAGIC || locs->count > FDT_LOCS_MAX) return 0;
+  return locs;
+}
+
+int fdt_copy_located(uintptr_t dst, uint32_t bufsize, uintptr_t src, const struct fdt_locs *locs,
+                     uint64_t mem_size, const struct fdt_patch *patches, int count)
+{
+  const struct fdt_loc *where[FDT_PATCH_MAX];
+  const uint32_t *in = (const uint32_t *)src;
+  uint32_t *out = (uint32_t *)dst;
+  uint32_t size, sum = FDT_MAGIC, i;
+  int p, l;
+
+  if (!locs || count > FDT_PATCH_MAX) return FDT_ERR_NOTFOUND;
+  if (!(size = fdt_size(src))) return FDT_ERR_BADFDT;
+  if (size > bufsize) return FDT_ERR_NOSPACE;
+
+  // Every patch must land on a known property of the same length
+  for (p = 0; p < count; ++p) {
+    for (l = 0; l < locs->count; ++l)
+      if (!strcmp(locs->loc[l].prop, patches[p].prop)) break;
+    if (patches[p].path || l == locs->count) return FDT_ERR_NOTFOUND;
+    if (patches[p].len >= 0 && patches[p].len != locs->loc[l].len) return FDT_ERR_NOTFOUND;
+    where[p] = &locs->loc[l];
+  }
+
+  // Copy and checksum in the same pass
+  for (i = 0; i < size/4; ++i) sum = fdt_sum_step(sum, out[i] = in[i]);
+  memcpy(out + i, in + i, size & 3);
+  sum = fdt_sum_tail(sum, (const uint8_t *)(out + i), size & 3);
+  if (sum != locs->checksum) return FDT_ERR_BADFDT;
+
+  for (p = 0; p < count; ++p)
+    memcpy((void *)(dst + where[p]->offset), patches[p].value, where[p]->len);
+
+  if (locs->mem_reg) {
+    struct fdt_scan_node parent, node;
+    struct mem_scan mem;
+    memset(&parent, 0, sizeof(parent));
+    parent.address_cells = locs->mem_cells >> 16;
+    parent.size_cells = locs->mem_cells & 0xffff;
+    node.parent = &parent;
+    mem.size = mem_size;
+    mem.memory = 1;
+    mem.reg_value = (const uint32_t *)(dst + locs->mem_reg);
+    mem.reg_len = locs->mem_reg_len;
+    mem_done(&node, &mem);
+  }
+  return count;
+}
+
+//////////////////////////////////////////// OVERLAY ///////////////////////////////////////////////
+
+#define FDT_PATH_MAX 256
+
+// Paths are built in static buffers to keep the hart stacks small
+static char overlay_path[FDT_PATH_MAX];
+static char overlay_ref[FDT_PATH_MAX];
+
+// Value of a property of the node at lex (FDT_BEGIN_NODE), or 0
+static uint32_t *fdt_node_prop(uintptr_t fdt, uint32_t *lex, const char *prop, int *len)
+{
+  struct fdt_header *header = (struct fdt_header *)fdt;
+  const char *strings = (const char *)(fdt + bswap(header->off_dt_strings));
+
+  if (!lex) return 0;
+  for (lex = fdt_node_props(lex); ; lex = fdt_next(lex)) {
+    uint32_t token = bswap(*lex);
+    if (token == FDT_PROP && !strcmp(strings + bswap(lex[2]), prop)) {
+      if (len) *len = bswap(lex[1]);
+      return lex + 3;
+    }
+    if (token != FDT_PROP && token != FDT_NOP) return 0;
+  }
+}
+
+static inline int is_phandle(const char *name)
+{
+  return !strcmp(name, "phandle") || !strcmp(name, "linux,phandle");
+}
+
+// Append "/name" to a path; the root is "/"
+static int path_push(char *path, const char *name, int namelen)
+{
+  int len = strlen(path);
+  if (len > 1) path[len++] = '/';
+  if (len + namelen >= FDT_PATH_MAX) return FDT_ERR_NOSPACE;
+  memcpy(path + len, name, namelen);
+  path[len + namelen] = 0;
+  return 0;
+}
+
+static void path_pop(char *path)
+{
+  int len = strlen(path);
+  while (len > 1 && path[len-1] != '/') --len;
+  if (len > 1) --len;
+  path[len] = 0;
+}
+
+// Largest phandle in the tree; with path != 0, the path of the node that
+// has phandle == want instead (0 if none)
+static uint32_t fdt_phandle_walk(uintptr_t fdt, uint32_t want, char *path)
+{
+  struct fdt_header *header = (struct fdt_header *)fdt;
+  const char *strings = (const char *)(fdt + bswap(header->off_dt_strings));
+  uint32_t *lex = (uint32_t *)(fdt + bswap(header->off_dt_struct));
+  uint32_t max = 0;
+  int depth = 0;
+
+  if (path) strcpy(path, "/");
+  for (; bswap(*lex) != FDT_END; lex = fdt_next(lex)) {
+    switch (bswap(*lex)) {
+      case FDT_BEGIN_NODE: {
+        const char *name = (const char *)(lex+1);
+        if (path && depth++ && path_push(path, name, strlen(name))) return 0;
+        break;
+      }
+      case FDT_END_NODE: {
+        if (path && --depth) path_pop(path);
+        break;
+      }
+      case FDT_PROP: {
+        uint32_t phandle;
+        if (!is_phandle(strings + bswap(lex[2])) || bswap(lex[1]) != 4) break;
+        phandle = bswap(lex[3]);
+        if (path && phandle == want) return phandle;
+        if (phandle > max && phandle != ~0U) max = phandle;
+        break;
+      }
+    }
+  }
+  return path ? 0 : max;
+}
+
+// Shift the overlay's own phandles, and every reference __local_fixups__
+// records to them, above those already in the base
+static int overlay_local_phandles(uintptr_t overlay, uint32_t delta)
+{
+  struct fdt_header *header = (struct fdt_header *)overlay;
+  const char *strings = (const char *)(overlay + bswap(header->off_dt_strings));
+  uint32_t *lex = (uint32_t *)(overlay + bswap(header->off_dt_struct));
+  uint32_t *fixups;
+  int depth = 0, len;
+
+  for (; bswap(*lex) != FDT_END; lex = fdt_next(lex))
+    if (bswap(*lex) == FDT_PROP && is_phandle(strings + bswap(lex[2])) && bswap(lex[1]) == 4)
+      lex[3] = bswap(bswap(lex[3]) + delta);
+
+  // __local_fixups__ mirrors the overlay tree; each property lists the
+  // byte offsets of phandle cells in the property of the same name
+  if (!(fixups = fdt_find_node(overlay, "/__local_fixups__"))) return 0;
+  strcpy(overlay_path, "/");
+  for (lex = fdt_node_props(fixups); depth >= 0; lex = fdt_next(lex)) {
+    switch (bswap(*lex)) {
+      case FDT_BEGIN_NODE: {
+        const char *name = (const char *)(lex+1);
+        if (path_push(overlay_path, name, strlen(name))) return FDT_ERR_NOSPACE;
+        ++depth;
+        break;
+      }
+      case FDT_END_NODE: {
+        if (depth--) path_pop(overlay_path);
+        break;
+      }
+      case FDT_PROP: {
+        const uint32_t *off = lex + 3;
+        uint32_t *value = fdt_node_prop(overlay, fdt_find_node(overlay, overlay_path), strings + bswap(lex[2]), &len);
+        int i;
+        if (!value) return FDT_ERR_BADFDT;
+        for (i = 0; i < (int)bswap(lex[1])/4; ++i) {
+          uint32_t at = bswap(off[i]);
+          if (at % 4 || at + 4 > (uint32_t)len) return FDT_ERR_BADFDT;
+          value[at/4] = bswap(bswap(value[at/4]) + delta);
+        }
+        break;
+      }
+      case FDT_END: {
+        return FDT_ERR_BADFDT;
+      }
+    }
+  }
+  return 0;
+}
+
+// Phandle of the base node at path, giving it one above those of both trees
+// if it has none
+static int overlay_base_phandle(uintptr_t fdt, uint32_t bufsize, uintptr_t overlay, const char *path, uint32_t *phandle)
+{
+  uint32_t *value, be, max;
+  int len, err;
+
+  value = fdt_node_prop(fdt, fdt_find_node(fdt, path), "phandle", &len);
+  if (value && len == 4) {
+    *phandle = bswap(*value);
+    return 0;
+  }
+  *phandle = fdt_phandle_walk(fdt, 0, 0);
+  if ((max = fdt_phandle_walk(overlay, 0, 0)) > *phandle) *phandle = max;
+  ++*phandle;
+  be = bswap(*phandle);
+  if ((err = fdt_setprop(fdt, bufsize, path, "phandle", &be, 4))) return err;
+  return 0;
+}
+
+// Point each overlay reference to a base label (__fixups__) at the base node
+// that __symbols__ names
+static int overlay_fixups(uintptr_t fdt, uint32_t bufsize, uintptr_t overlay)
+{
+  struct fdt_header *header = (struct fdt_header *)overlay;
+  const char *strings = (const char *)(overlay + bswap(header->off_dt_strings));
+  uint32_t *lex = fdt_find_node(overlay, "/__fixups__");
+  int err;
+
+  if (!lex) return 0;
+  for (lex = fdt_node_props(lex); bswap(*lex) == FDT_PROP || bswap(*lex) == FDT_NOP; lex = fdt_next(lex)) {
+    const char *label = strings + bswap(lex[2]);
+    const char *refs = (const char *)(lex + 3), *end = refs + bswap(lex[1]);
+    const char *target;
+    uint32_t phandle;
+    int len;
+
+    if (bswap(*lex) == FDT_NOP) continue;
+    target = (const char *)fdt_node_prop(fdt, fdt_find_node(fdt, "/__symbols__"), label, &len);
+    if (!target || len >= FDT_PATH_MAX) return FDT_ERR_NOTFOUND;
+    memcpy(overlay_path, target, len);
+    overlay_path[len] = 0;
+    if ((err = overlay_base_phandle(fdt, bufsize, overlay, overlay_path, &phandle))) return err;
+
+    // Each reference is "path:property:offset"
+    for (; refs < end; refs += strlen(refs) + 1) {
+      char *prop, *off;
+      uint32_t *value, at = 0;
+      if (strlen(refs) >= FDT_PATH_MAX) return FDT_ERR_BADFDT;
+      strcpy(overlay_ref, refs);
+      for (prop = overlay_ref; *prop && *prop != ':'; ++prop) ;
+      for (off = prop + (*prop != 0); *off && *off != ':'; ++off) ;
+      if (!*prop || !*off) return FDT_ERR_BADFDT;
+      *prop++ = 0;
+      *off++ = 0;
+      for (; *off >= '0' && *off <= '9'; ++off) at = at * 10 + (*off - '0');
+      value = fdt_node_prop(overlay, fdt_find_node(overlay, overlay_ref), prop, &len);
+      if (!value || at % 4 || at + 4 > (uint32_t)len) return FDT_ERR_BADFDT;
+      value[at/4] = bswap(phandle);
+    }
+  }
+  return 0;
+}
+
+// Base path a fragment applies to, from target-path or a target phandle
+static int overlay_target(uintptr_t fdt, uintptr_t overlay, uint32_t *fragment, char *path)
+{
+  uint32_t *value;
+  int len;
+
+  if ((value = fdt_node_prop(overlay, fragment, "target-path", &len))) {
+    if (len >= FDT_PATH_MAX) return FDT_ERR_NOSPACE;
+    memcpy(path, value, len);
+    path[len] = 0;
+    return fdt_find_node(fdt, path) ? 0 : FDT_ERR_NOTFOUND;
+  }
+  if ((value = fdt_node_prop(overlay, fragment, "target", &len)) && len == 4)
+    return fdt_phandle_walk(fdt, bswap(*value), path) ? 0 : FDT_ERR_NOTFOUND;
+  return FDT_ERR_NOTFOUND;
+}
+
+// Base node offsets from the fragment's target down to the node being merged
+static uint32_t overlay_nodes[FDT_SCAN_MAX_DEPTH];
+
+// Merge the properties and subnodes under __overlay__ into the base node at
+// path, in one walk that tracks the base node each overlay node lands on
+static int overlay_merge(uintptr_t fdt, uint32_t bufsize, uintptr_t overlay, uint32_t *lex, const char *path)
+{
+  struct fdt_header *header = (struct fdt_header *)overlay;
+  const char *strings = (const char *)(overlay + bswap(header->off_dt_strings));
+  int depth = 0, err;
+
+  if (!(overlay_nodes[0] = (uintptr_t)fdt_find_node(fdt, path))) return FDT_ERR_NOTFOUND;
+  overlay_nodes[0] -= fdt;
+
+  for (lex = fdt_node_props(lex); depth >= 0; lex = fdt_next(lex)) {
+    switch (bswap(*lex)) {
+      case FDT_PROP: {
+        err = fdt_setprop_at(fdt, bufsize, overlay_nodes[depth], strings + bswap(lex[2]), lex + 3, bswap(lex[1]));
+        if (err) return err;
+        break;
+      }
+      case FDT_BEGIN_NODE: {
+        if (depth + 1 == FDT_SCAN_MAX_DEPTH) return FDT_ERR_NOSPACE;
+        err = fdt_add_node_at(fdt, bufsize, overlay_nodes[depth], (const char *)(lex+1), &overlay_nodes[depth+1]);
+        if (err && err != FDT_ERR_EXISTS) return err;
+        ++depth;
+        break;
+      }
+      case FDT_END_NODE: {
+        --depth;
+        break;
+      }
+      case FDT_END: {
+        return FDT_ERR_BADFDT;
+      }
+    }
+  }
+  return 0;
+}
+
+// The fragment@N/__overlay__ child of the overlay root, or 0
+static uint32_t *overlay_body(uint32_t *fragment)
+{
+  uint32_t *lex;
+  for (lex = fdt_node_props(fragment); ; ) {
+    switch (bswap(*lex)) {
+      case FDT_BEGIN_NODE:
+        if (!strcmp((const char *)(lex+1), "__overlay__")) return lex;
+        lex = fdt_skip_node(lex);
+        break;
+      case FDT_PROP:
+      case FDT_NOP:
+        lex = fdt_next(lex);
+        break;
+      default:
+        return 0;
+    }
+  }
+}
+
+// Does c start with a "/__overlay__" path component?
+static int is_overlay_component(const char *c)
+{
+  const char *want = "/__overlay__";
+  for (; *want; ++c, ++want)
+    if (*c != *want) return 0;
+  return !*c || *c == '/';
+}
+
+// Rewrite the overlay's labels "/fragment@N/__overlay__/rest" into base paths
+static int overlay_symbols(uintptr_t fdt, uint32_t bufsize, uintptr_t overlay)
+{
+  struct fdt_header *header = (struct fdt_header *)overlay;
+  const char *strings = (const char *)(overlay + bswap(header->off_dt_strings));
+  uint32_t *lex = fdt_find_node(overlay, "/__symbols__");
+  int err;
+
+  if (!lex || !fdt_find_node(fdt, "/__symbols__")) return 0;
+  for (lex = fdt_node_props(lex); bswap(*lex) == FDT_PROP || bswap(*lex) == FDT_NOP; lex = fdt_next(lex)) {
+    const char *value = (const char *)(lex + 3);
+    const char *rest = value + 1;
+    uint32_t *fragment;
+    int len;
+
+    if (bswap(*lex) == FDT_NOP) continue;
+    if (strlen(value) >= FDT_PATH_MAX) return FDT_ERR_BADFDT;
+    while (*rest && *rest != '/') ++rest;
+    if (*value != '/' || !*rest || !is_overlay_component(rest)) continue; // label of a base node
+    memcpy(overlay_ref, value, rest - value);
+    overlay_ref[rest - value] = 0;
+    rest += sizeof("/__overlay__") - 1;
+    if (!(fragment = fdt_find_node(overlay, overlay_ref))) continue;
+    if ((err = overlay_target(fdt, overlay, fragment, overlay_path))) return err;
+    if (*rest) {
+      len = strlen(overlay_path);
+      if (len == 1) len = 0;
+      if (len + strlen(rest) >= FDT_PATH_MAX) return FDT_ERR_NOSPACE;
+      strcpy(overlay_path + len, rest);
+    }
+    err = fdt_setprop(fdt, bufsize, "/__symbols__", strings + bswap(lex[2]), overlay_path, strlen(overlay_path) + 1);
+    if (err) return err;
+  }
+  return 0;
+}
+
+int fdt_overlay_apply(uintptr_t fdt, uint32_t bufsize, uintptr_t overlay)
+{
+  struct fdt_header *header = (struct fdt_header *)overlay;
+  uint32_t *lex;
+  int depth = 0, err;
+
+  if ((err = fdt_check_edit(fdt)) || (err = fdt_check_edit(overlay))) return err;
+
+  if ((err = overlay_local_phandles(overlay, fdt_phandle_walk(fdt, 0, 0)))) return err;
+  if ((err = overlay_fixups(fdt, bufsize, overlay))) return err;
+
+  // Fragments are the root's children with an __overlay__; one walk merges them all
+  lex = (uint32_t *)(overlay + bswap(header->off_dt_struct));
+  for (; bswap(*lex) != FDT_END; ) {
+    uint32_t token = bswap(*lex);
+    if (token == FDT_BEGIN_NODE && depth == 1) {
+      uint32_t *body = overlay_body(lex);
+      if (body) {
+        if ((err = overlay_target(fdt, overlay, lex, overlay_path))) return err;
+        if ((err = overlay_merge(fdt, bufsize, overlay, body, overlay_path))) return err;
+      }
+      lex = fdt_skip_node(lex);
+      continue;
+    }
+    if (token == FDT_BEGIN_NODE) ++depth;
+    if (token == FDT_END_NODE) --depth;
+    lex = fdt_next(lex);
+  }
+
+  return overlay_symbols(fdt, bufsize, overlay);
 }
@@ -42,16 +42,32 @@ struct fdt_scan_prop {
   int len; // in bytes of value
 };
 
+// Any callback may return FDT_SCAN_FOUND to end the scan right there
+#define FDT_SCAN_FOUND 1
+
 struct fdt_cb {
-  void (*open)(const struct fdt_scan_node *node, void *extra);
-  void (*prop)(const struct fdt_scan_prop *prop, void *extra);
-  void (*done)(const struct fdt_scan_node *node, void *extra); // last property was seen
-  int  (*close)(const struct fdt_scan_node *node, void *extra); // -1 => delete the node + children
+  int (*open)(const struct fdt_scan_node *node, void *extra);
+  int (*prop)(const struct fdt_scan_prop *prop, void *extra);
+  int (*done)(const struct fdt_scan_node *node, void *extra); // last property was seen
+  int (*close)(const struct fdt_scan_node *node, void *extra); // -1 => delete the node + children
   void *extra;
 };
 
-// Scan the contents of FDT
-void fdt_scan(uintptr_t fdt, const struct fdt_cb *cb);
+// Nodes are tracked on a fixed stack; anything nested deeper ends the scan
+#ifndef FDT_SCAN_MAX_DEPTH
+#define FDT_SCAN_MAX_DEPTH 8
+#endif
+
+// Errors of the scanner and the editors
+#define FDT_ERR_NOTFOUND -1
+#define FDT_ERR_EXISTS   -2
+#define FDT_ERR_NOSPACE  -3
+#define FDT_ERR_BADFDT   -4
+#define FDT_ERR_DEPTH    -5 // nodes nested deeper than FDT_SCAN_MAX_DEPTH
+
+// Scan the contents of FDT; returns FDT_SCAN_FOUND if a callback stopped it,
+// or FDT_ERR_DEPTH, with the callbacks for the nodes before it already made
+int fdt_scan(uintptr_t fdt, const struct fdt_cb *cb);
 uint32_t fdt_size(uintptr_t fdt);
 
 // Extract fields
@@ -59,7 +75,80 @@ const uint32_t *fdt_get_address(const struct fdt_scan_node *node, const uint32_t
 const uint32_t *fdt_get_size(const struct fdt_scan_node *node, const uint32_t *base, uint64_t *value);
 int fdt_string_list_index(const struct fdt_scan_prop *prop, const char *str); // -1 if not found
 
-void fdt_reduce_mem(uintptr_t fdt, uintptr_t size);
+// Value of a property of the node at path, or 0; stops scanning once found
+uint32_t *fdt_get_prop(uintptr_t fdt, const char *path, const char *prop, int *len);
+
+// Match a node against an absolute path such as "/soc/ethernet@10090000"
+int fdt_node_is(const struct fdt_scan_node *node, const char *path);
+
+int fdt_reduce_mem(uintptr_t fdt, uintptr_t size); // 0 or FDT_ERR_DEPTH
 void fdt_set_prop(uintptr_t fdt, const char *prop, uint8_t *value);
 
+// One fixed-size property edit; the property keeps its compiled size
+struct fdt_patch {
+  const char *path;  // node to patch; 0 => every node carrying the property
+  const char *prop;
+  const void *value;
+  int len;           // bytes available in value; -1 => trust the property length
+};
+
+#define FDT_PATCH_MAX 32
+
+// Apply up to FDT_PATCH_MAX patches in one scan; returns the number of properties written
+// or FDT_ERR_DEPTH
+int fdt_set_props(uintptr_t fdt, const struct fdt_patch *patches, int count);
+
+// In-place structural edits. bufsize is the space reserved at fdt; the
+// blocks behind an edit are moved within it and the header is updated.
+
+int fdt_setprop(uintptr_t fdt, uint32_t bufsize, const char *path, const char *prop, const void *value, int len); // create or resize
+int fdt_add_node(uintptr_t fdt, uint32_t bufsize, const char *parent, const char *name);
+
+// Copy src to dst in one pass, dropping NOPs, applying up to FDT_PATCH_MAX
+// patches (a patch may change the property length) and reducing the memory
+// nodes to mem_size. dst and src must not overlap. Returns the number of
+// properties patched or FDT_ERR_*.
+int fdt_copy(uintptr_t dst, uint32_t bufsize, uintptr_t src, uint64_t mem_size,
+             const struct fdt_patch *patches, int count);
+
+// Squeeze out FDT_NOPs and unreferenced or duplicate strings; the strings
+// are rebuilt in the space past totalsize. Returns the bytes saved or FDT_ERR_*.
+int fdt_pack(uintptr_t fdt, uint32_t bufsize);
+
+// Property locations precomputed on the host by fdt/fdtlocs and stored
+// 8-byte aligned right after the DTB. Fields are little-endian, like the hart.
+#define FDT_LOCS_MAGIC 0x534c4446 // "FDLS"
+#define FDT_LOCS_MAX   4
+
+struct fdt_loc {
+  char prop[24];   // occurs exactly once in the DTB
+  uint32_t offset; // of the value, from the start of the DTB
+  uint32_t len;
+};
+
+struct fdt_locs {
+  uint32_t magic;
+  uint32_t checksum;    // fdt_checksum() over totalsize
+  uint32_t mem_reg;     // offset of the only memory node's reg; 0 => none
+  uint32_t mem_reg_len;
+  uint32_t mem_cells;   // #address-cells << 16 | #size-cells that reg uses
+  uint32_t count;
+  struct fdt_loc loc[FDT_LOCS_MAX];
+};
+
+uint32_t fdt_checksum(uintptr_t fdt, uint32_t size);
+const struct fdt_locs *fdt_locs_find(uintptr_t fdt); // 0 => no table
+// As fdt_copy(), but a memcpy plus direct stores at the precomputed offsets.
+// Only unqualified patches of unchanged length are supported; anything else,
+// or a checksum mismatch, returns FDT_ERR_NOTFOUND/BADFDT so the caller can
+// fall back to fdt_copy().
+int fdt_copy_located(uintptr_t dst, uint32_t bufsize, uintptr_t src, const struct fdt_locs *locs,
+                     uint64_t mem_size, const struct fdt_patch *patches, int count);
+
+// Merge a dtc -@ overlay (fragment@N with target or target-path, __overlay__,
+// __fixups__, __local_fixups__, __symbols__) into fdt. The overlay's phandles
+// are rewritten in place. On error fdt may be partly merged; callers that
+// need it intact keep a copy.
+int fdt_overlay_apply(uintptr_t fdt, uint32_t bufsize, uintptr_t overlay);
+
 #endif
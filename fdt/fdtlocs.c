@@ -0,0 +1,144 @@
+/* Copyright (c) 2018 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/* See the file LICENSE for further information */
+
+// Host tool: fdtlocs <in.dtb> <out.locs> <property>...
+//
+// Writes a struct fdt_locs giving the value offset of each named property
+// and of the memory node's reg, so the FSBL can patch the DTB without
+// searching it. A property that is missing or occurs more than once is left
+// out; a DTB with more than one memory node gets an empty (magic 0) table.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fdt/fdt.h"
+
+struct locs_scan {
+  uintptr_t fdt;
+  struct fdt_locs *locs;
+  int found[FDT_LOCS_MAX];
+  int memory_nodes;
+  int memory;
+  const struct fdt_scan_prop *reg;
+  struct fdt_scan_prop reg_prop;
+};
+
+static int locs_open(const struct fdt_scan_node *node, void *extra)
+{
+  struct locs_scan *scan = (struct locs_scan *)extra;
+  scan->memory = 0;
+  scan->reg = 0;
+  return 0;
+}
+
+static int locs_prop(const struct fdt_scan_prop *prop, void *extra)
+{
+  struct locs_scan *scan = (struct locs_scan *)extra;
+  struct fdt_locs *locs = scan->locs;
+  uint32_t i;
+
+  for (i = 0; i < locs->count; ++i) {
+    if (strcmp(prop->name, locs->loc[i].prop)) continue;
+    locs->loc[i].offset = (uintptr_t)prop->value - scan->fdt;
+    locs->loc[i].len = prop->len;
+    scan->found[i]++;
+  }
+  if (!strcmp(prop->name, "device_type") && !strcmp((const char *)prop->value, "memory")) {
+    scan->memory = 1;
+  } else if (!strcmp(prop->name, "reg")) {
+    scan->reg_prop = *prop;
+    scan->reg = &scan->reg_prop;
+  }
+  return 0;
+}
+
+static int locs_done(const struct fdt_scan_node *node, void *extra)
+{
+  struct locs_scan *scan = (struct locs_scan *)extra;
+  struct fdt_locs *locs = scan->locs;
+
+  if (!scan->memory) return 0;
+  scan->memory_nodes++;
+  if (!scan->reg || !node->parent) return 0;
+  locs->mem_reg = (uintptr_t)scan->reg->value - scan->fdt;
+  locs->mem_reg_len = scan->reg->len;
+  locs->mem_cells = node->parent->address_cells << 16 | node->parent->size_cells;
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  static uint8_t dtb[1024 * 1024];
+  struct fdt_locs locs;
+  struct locs_scan scan;
+  struct fdt_cb cb;
+  uint32_t size, i, kept;
+  size_t len;
+  FILE *f;
+
+  if (argc < 3 || argc - 3 > FDT_LOCS_MAX) {
+    fprintf(stderr, "usage: %s <in.dtb> <out.locs> [property]... (at most %d)\n", argv[0], FDT_LOCS_MAX);
+    return 1;
+  }
+
+  if (!(f = fopen(argv[1], "rb"))) { perror(argv[1]); return 1; }
+  len = fread(dtb, 1, sizeof(dtb), f);
+  fclose(f);
+  size = fdt_size((uintptr_t)dtb);
+  if (!size || size > len) {
+    fprintf(stderr, "%s: not a complete DTB\n", argv[1]);
+    return 1;
+  }
+
+  memset(&locs, 0, sizeof(locs));
+  memset(&scan, 0, sizeof(scan));
+  for (i = 0; i < (uint32_t)argc - 3; ++i) {
+    if (strlen(argv[i+3]) >= sizeof(locs.loc[i].prop)) {
+      fprintf(stderr, "%s: property name too long\n", argv[i+3]);
+      return 1;
+    }
+    strcpy(locs.loc[i].prop, argv[i+3]);
+  }
+  locs.count = argc - 3;
+
+  memset(&cb, 0, sizeof(cb));
+  cb.open = locs_open;
+  cb.prop = locs_prop;
+  cb.done = locs_done;
+  cb.extra = &scan;
+  scan.fdt = (uintptr_t)dtb;
+  scan.locs = &locs;
+  if (fdt_scan((uintptr_t)dtb, &cb) == FDT_ERR_DEPTH) {
+    fprintf(stderr, "%s: nodes nested deeper than %d\n", argv[1], FDT_SCAN_MAX_DEPTH);
+    return 1;
+  }
+
+  // Keep only the properties the FSBL can find blindly
+  for (i = kept = 0; i < locs.count; ++i) {
+    if (scan.found[i] != 1) {
+      fprintf(stderr, "%s: '%s' occurs %d times, left out\n", argv[1], locs.loc[i].prop, scan.found[i]);
+      continue;
+    }
+    locs.loc[kept++] = locs.loc[i];
+  }
+  memset(&locs.loc[kept], 0, (locs.count - kept) * sizeof(locs.loc[0]));
+  locs.count = kept;
+
+  if (scan.memory_nodes > 1) {
+    fprintf(stderr, "%s: %d memory nodes, writing an empty table\n", argv[1], scan.memory_nodes);
+    memset(&locs, 0, sizeof(locs));
+  } else {
+    locs.magic = FDT_LOCS_MAGIC;
+    locs.checksum = fdt_checksum((uintptr_t)dtb, size);
+  }
+
+  if (!(f = fopen(argv[2], "wb")) || fwrite(&locs, sizeof(locs), 1, f) != 1) {
+    perror(argv[2]);
+    return 1;
+  }
+  fclose(f);
+  return 0;
+}
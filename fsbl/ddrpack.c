@@ -0,0 +1,139 @@
+/* Copyright (c) 2018 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/* See the file LICENSE for further information */
+
+// Host tool: packs the DDR controller and PHY register tables of one speed
+// grade into the streams ddrpack_replay() understands and prints them as a C
+// header. Build it with DDR_GRADE set to the data rate in MT/s and
+// DDR_REGCONFIG_CTL/DDR_REGCONFIG_PHY naming that grade's register headers.
+// The output is decoded again here and compared against the tables before
+// anything is printed.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef DDR_GRADE
+#error "Must define DDR_GRADE"
+#endif
+#include DDR_REGCONFIG_CTL
+#include DDR_REGCONFIG_PHY
+
+#define DENALI_PHY_DATA ddr_phy_settings
+#define DENALI_CTL_DATA ddr_ctl_settings
+#include "fsbl/ddrregs.h"
+#include "fsbl/ddrpack.h"
+
+#define CTL_REGS (sizeof(ddr_ctl_settings) / sizeof(ddr_ctl_settings[0]))
+#define PHY_REGS (sizeof(ddr_phy_settings) / sizeof(ddr_phy_settings[0]))
+#define STREAM_MAX 4096
+
+struct stream {
+  uint32_t words[STREAM_MAX];
+  int len;
+  uint32_t history[CTL_REGS + PHY_REGS]; // values in stream order, for COPY
+  int pos;
+  int literal; // index of the open LIT header, or -1
+};
+
+static void emit(struct stream *s, uint32_t word)
+{
+  if (s->len == STREAM_MAX) {
+    fprintf(stderr, "ddrpack: stream overflow\n");
+    exit(1);
+  }
+  s->words[s->len++] = word;
+}
+
+// Pack the registers first..first+count-1, in that order
+static void pack_segment(struct stream *s, const uint32_t *table, int first, int count)
+{
+  const uint32_t *v = table + first;
+  int i = 0;
+
+  emit(s, DDRPACK_OP(DDRPACK_SEEK, first));
+  s->literal = -1;
+  while (i < count) {
+    int fill = 1, copy = 0, dist = 0, d;
+
+    while (i + fill < count && v[i + fill] == v[i]) ++fill;
+    for (d = 1; d <= DDRPACK_DIST_MAX && d <= s->pos; ++d) {
+      int n = 0;
+      // The copy source may run into the words it is producing
+      while (i + n < count && n < DDRPACK_COPY_MAX &&
+             v[i + n] == (n < d ? s->history[s->pos - d + n] : v[i + n - d])) ++n;
+      if (n > copy) { copy = n; dist = d; }
+    }
+
+    if (copy >= 2 && copy >= fill) {
+      emit(s, DDRPACK_COPY_OP(copy, dist));
+      s->literal = -1;
+    } else if (fill >= 3) {
+      copy = fill;
+      emit(s, DDRPACK_OP(DDRPACK_FILL, fill));
+      emit(s, v[i]);
+      s->literal = -1;
+    } else {
+      copy = 1;
+      if (s->literal < 0) {
+        s->literal = s->len;
+        emit(s, DDRPACK_OP(DDRPACK_LIT, 0));
+      }
+      s->words[s->literal]++;
+      emit(s, v[i]);
+    }
+
+    memcpy(s->history + s->pos, v + i, copy * sizeof(uint32_t));
+    s->pos += copy;
+    i += copy;
+  }
+}
+
+static int verify(const struct stream *s, const uint32_t *table, int count)
+{
+  static uint32_t regs[CTL_REGS + PHY_REGS];
+  int i;
+
+  memset(regs, 0xa5, sizeof(regs));
+  ddrpack_replay(regs, s->words);
+  for (i = 0; i < count; ++i) {
+    if (regs[i] != table[i]) {
+      fprintf(stderr, "ddrpack: register %d decodes to 0x%08x, want 0x%08x\n", i, regs[i], table[i]);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void print(const char *name, const struct stream *s, int regs)
+{
+  int i;
+
+  printf("\n// %d registers in %d words\n", regs, s->len);
+  printf("static const uint32_t %s_%d[%d] = {", name, DDR_GRADE, s->len);
+  for (i = 0; i < s->len; ++i)
+    printf("%s0x%08x,", i % 8 ? " " : "\n  ", s->words[i]);
+  printf("\n};\n");
+}
+
+int main(void)
+{
+  static struct stream ctl, phy;
+
+  pack_segment(&ctl, ddr_ctl_settings, 0, CTL_REGS);
+  emit(&ctl, DDRPACK_END);
+
+  // The PHY registers from 1152 up are programmed before the slices
+  pack_segment(&phy, ddr_phy_settings, 1152, PHY_REGS - 1152);
+  pack_segment(&phy, ddr_phy_settings, 0, 1152);
+  emit(&phy, DDRPACK_END);
+
+  if (verify(&ctl, ddr_ctl_settings, CTL_REGS) || verify(&phy, ddr_phy_settings, PHY_REGS)) return 1;
+
+  printf("/* Generated by fsbl/ddrpack from %s and %s; do not edit */\n", DDR_REGCONFIG_CTL, DDR_REGCONFIG_PHY);
+  print("ddr_ctl_packed", &ctl, CTL_REGS);
+  print("ddr_phy_packed", &phy, PHY_REGS);
+  return 0;
+}
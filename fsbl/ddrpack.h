@@ -0,0 +1,73 @@
+/* Copyright (c) 2018 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/* See the file LICENSE for further information */
+
+#ifndef _SIFIVE_DDRPACK_H
+#define _SIFIVE_DDRPACK_H
+
+#include <stdint.h>
+
+// Packed DDR register streams, produced on the host by fsbl/ddrpack.
+// Each op is one header word, op in [31:30]:
+//   LIT  n        n literal words follow
+//   FILL n        one word follows, written n times
+//   COPY n, dist  repeat n words from dist words back in the stream
+//                 (n in [15:0], dist in [29:16]); the PHY slices repeat
+//                 every 128 registers
+//   SEEK index    continue at register index
+// and the stream ends with DDRPACK_END.
+#define DDRPACK_LIT       0
+#define DDRPACK_FILL      1
+#define DDRPACK_COPY      2
+#define DDRPACK_SEEK      3
+#define DDRPACK_END       0xffffffffU
+#define DDRPACK_ARG_MASK  0x3fffffffU
+#define DDRPACK_COPY_MAX  0xffff
+#define DDRPACK_DIST_MAX  128
+
+#define DDRPACK_OP(op, arg)           (((uint32_t)(op) << 30) | (arg))
+#define DDRPACK_COPY_OP(n, dist)      DDRPACK_OP(DDRPACK_COPY, ((uint32_t)(dist) << 16) | (n))
+
+// Write every register a stream describes, in stream order
+static inline void ddrpack_replay(volatile uint32_t *reg, const uint32_t *stream)
+{
+  static uint32_t ring[DDRPACK_DIST_MAX]; // the last words written, for COPY
+  unsigned int at = 0, pos = 0;
+  uint32_t op, n, value;
+
+  while ((op = *stream++) != DDRPACK_END) {
+    n = op & DDRPACK_ARG_MASK;
+    switch (op >> 30) {
+      case DDRPACK_LIT:
+        while (n--) {
+          value = *stream++;
+          reg[pos++] = value;
+          ring[at++ % DDRPACK_DIST_MAX] = value;
+        }
+        break;
+      case DDRPACK_FILL:
+        value = *stream++;
+        while (n--) {
+          reg[pos++] = value;
+          ring[at++ % DDRPACK_DIST_MAX] = value;
+        }
+        break;
+      case DDRPACK_COPY: {
+        unsigned int dist = n >> 16;
+        n &= DDRPACK_COPY_MAX;
+        while (n--) {
+          value = ring[(at - dist) % DDRPACK_DIST_MAX];
+          reg[pos++] = value;
+          ring[at++ % DDRPACK_DIST_MAX] = value;
+        }
+        break;
+      }
+      case DDRPACK_SEEK:
+        pos = n;
+        break;
+    }
+  }
+}
+
+#endif
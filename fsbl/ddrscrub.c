@@ -0,0 +1,58 @@
+/* Copyright (c) 2018 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/* See the file LICENSE for further information */
+
+#include <stdint.h>
+#include <string.h>
+#include <sifive/platform.h>
+#include <sifive/devices/pdma.h>
+#include "fsbl/ddrscrub.h"
+
+// Every channel reads the same window of the zero device, so it stays in
+// the L2; the hart clears a block at a time so the channel is rearmed soon
+#define DDRSCRUB_DMA_CHUNK (256UL * 1024UL)
+#define DDRSCRUB_CPU_BLOCK (64UL * 1024UL)
+
+static inline uint64_t min_u64(uint64_t a, uint64_t b)
+{
+  return a < b ? a : b;
+}
+
+int ddrscrub_run(uintptr_t base, uint64_t size, int channel)
+{
+  uintptr_t lo = base, hi = base + size, dma = 0;
+  uint64_t dma_bytes = 0, n;
+  int errors = 0;
+
+  while (lo < hi) {
+    if (dma_bytes && !pdma_busy(DMA_CTRL_ADDR, channel)) {
+      if (pdma_error(DMA_CTRL_ADDR, channel)) {
+        memset((void *) dma, 0, dma_bytes);
+        errors++;
+      }
+      dma_bytes = 0;
+    }
+    if (!dma_bytes) {
+      dma = lo;
+      dma_bytes = min_u64(DDRSCRUB_DMA_CHUNK, hi - lo);
+      pdma_start(DMA_CTRL_ADDR, channel, dma, CACHEABLE_ZERO_MEM_ADDR, dma_bytes);
+      lo += dma_bytes;
+    } else {
+      n = min_u64(DDRSCRUB_CPU_BLOCK, hi - lo);
+      hi -= n;
+      memset((void *) hi, 0, n);
+    }
+  }
+
+  if (dma_bytes) {
+    while (pdma_busy(DMA_CTRL_ADDR, channel)) ;
+    if (pdma_error(DMA_CTRL_ADDR, channel)) {
+      memset((void *) dma, 0, dma_bytes);
+      errors++;
+    }
+  }
+  pdma_release(DMA_CTRL_ADDR, channel);
+  asm volatile ("fence" : : : "memory");
+  return errors;
+}
@@ -0,0 +1,21 @@
+/* Copyright (c) 2018 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/* See the file LICENSE for further information */
+
+#ifndef _SIFIVE_DDRSCRUB_H
+#define _SIFIVE_DDRSCRUB_H
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+
+// Zero [base, base + size) with a PDMA channel and the calling hart together:
+// the channel copies from the cacheable zero device working up from base,
+// while the hart clears from the top down. Returns the number of transfers
+// the channel failed, which the hart then cleared itself.
+int ddrscrub_run(uintptr_t base, uint64_t size, int channel);
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _SIFIVE_DDRSCRUB_H */
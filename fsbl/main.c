@@ -13,20 +13,80 @@
 #include <uart/uart.h>
 #include <stdio.h>
 
-#include "regconfig-ctl.h"
-#include "regconfig-phy.h"
 #include "fsbl/ux00ddr.h"
+#include "fsbl/memtest.h"
+#include "fsbl/ddrscrub.h"
 
+// The register tables of DDR_GRADES and DDR_GRADE_LIST, generated from the
+// Makefile; packed by fsbl/ddrpack unless DDR_UNPACKED_TABLES
+#include "fsbl/ddrgrades.h"
+#ifdef DDR_UNPACKED_TABLES
 #define DENALI_PHY_DATA ddr_phy_settings
 #define DENALI_CTL_DATA ddr_ctl_settings
 #include "ddrregs.h"
+#endif
+
+// DDR speed grades with a register set, fastest first. Training drops to the
+// next grade when lanes keep failing; the unpacked tables only exist for one.
+struct ddr_grade {
+  unsigned int mts;     // data rate in MT/s
+  uint32_t pll_f;       // DDR PLL multiplier and output divider
+  uint32_t pll_q;
+  const uint32_t *ctl;  // register tables, packed unless DDR_UNPACKED_TABLES
+  const uint32_t *phy;
+  uint32_t ctl_bytes;
+  uint32_t phy_bytes;
+};
+
+#ifdef DDR_UNPACKED_TABLES
+#define DDR_GRADE(mts, f, q) \
+  { mts, f, q, ddr_ctl_settings, ddr_phy_settings, sizeof(ddr_ctl_settings), sizeof(ddr_phy_settings) }
+#else
+#define DDR_GRADE(mts, f, q) \
+  { mts, f, q, ddr_ctl_packed_##mts, ddr_phy_packed_##mts, sizeof(ddr_ctl_packed_##mts), sizeof(ddr_phy_packed_##mts) }
+#endif
+static const struct ddr_grade ddr_grades[] = {
+  DDR_GRADE_LIST
+};
+#define NUM_DDR_GRADES (sizeof(ddr_grades) / sizeof(ddr_grades[0]))
+
+// The controller is set up for DDR_MAX_SIZE and the fitted size is probed
+// at boot, unless DDR_SIZE fixes it
+#ifdef DDR_SIZE
+  #define DDR_MAX_SIZE DDR_SIZE
+#else
+  #define DDR_MAX_SIZE (8UL * 1024UL * 1024UL * 1024UL)
+#endif
+// Smallest DDR the probe reports
+#define DDR_MIN_SIZE (256UL * 1024UL * 1024UL)
+#define DDR_PROBE_MARK 0x5a5aa5a5d00dfeedUL
+// Full trainings before giving up on lanes that hit the RX calibration
+// errata; DDR_TRAIN_BEST_EFFORT boots with them anyway instead of failing
+#ifndef DDR_TRAIN_ATTEMPTS
+  #define DDR_TRAIN_ATTEMPTS 3
+#endif
+// The controller's AXI read interleave and optimal read-modify-write are
+// turned off unless these are set; ddr_read_interleave and ddr_optimal_rmodw
+// can also be patched per board
+#ifndef DDR_AXI_READ_INTERLEAVE
+  #define DDR_AXI_READ_INTERLEAVE 0
+#endif
+#ifndef DDR_OPTIMAL_RMODW
+  #define DDR_OPTIMAL_RMODW 0
+#endif
+
+// The DTB is copied to the top of DDR; the rest of this space lets fdt_setprop()
+// and fdt_add_node() grow it in place
+#define DTB_RESERVED_SIZE (2UL * 1024UL * 1024UL)
 
-#define DDR_SIZE  (8UL * 1024UL * 1024UL * 1024UL)
-#define DDRCTLPLL_F 55
-#define DDRCTLPLL_Q 2
+// Board-specific DTB overlays, stored back to back and 8-byte aligned, are
+// taken from chiplink memory after the chiplink DTB and from this partition
+#define CHIPLINK_OVERLAY_ADDR 0x2ff0100000UL
 
 #include <sifive/platform.h>
+#include <sifive/smp.h>
 #include <sifive/barrier.h>
+#include <sifive/workq.h>
 #include <stdatomic.h>
 
 #include <sifive/devices/ccache.h>
@@ -34,9 +94,92 @@
 #include <spi/spi.h>
 #include <ux00boot/ux00boot.h>
 #include <gpt/gpt.h>
+#include <clkutils/clkutils.h>
 
 #define NUM_CORES 5
 
+// BOOT_HART (sifive/smp.h) runs the boot flow on its own stack, which the
+// linker script sizes and start.S sets up. Its unused part is painted
+// before the hand-off and a guard band at its end is checked afterwards.
+#define BOOT_STACK_PAINT 0x5a5a5a5a5a5a5a5aUL
+#define BOOT_STACK_GUARD 256 // bytes
+extern uint64_t _boot_sp[], _boot_stack_end[];
+
+// Core clock profiles, fastest first. The fastest one core_max_mhz allows
+// and the TileLink clock ratio permits is tried first, dropping to the next
+// if the PLL does not lock within CORE_PLL_LOCK_TIMEOUT_US. Parts qualified
+// above 1 GHz are built with CORE_MAX_MHZ or have core_max_mhz patched.
+#ifndef CORE_MAX_MHZ
+  #define CORE_MAX_MHZ 1000
+#endif
+#ifndef CORE_PLL_LOCK_TIMEOUT_US
+  #define CORE_PLL_LOCK_TIMEOUT_US 1000
+#endif
+#define TLCLK_MAX_MHZ 500 // with tlclk = coreclk (TLCLKSEL set)
+
+#define COREPLL_CFG(f, q) (PLL_R(0) | PLL_F(f) | PLL_Q(q) | PLL_RANGE(0x4) | PLL_BYPASS(0) | PLL_FSE(1))
+
+struct core_clock {
+  unsigned int mhz;
+  uint32_t pllcfg;
+};
+
+static const struct core_clock core_clocks[] = {
+  { 1400, COREPLL_CFG(41, 1) }, // 2800 MHz VCO / 2
+  { 1000, COREPLL_CFG(59, 2) }, // 4000 MHz VCO / 4
+  {  500, COREPLL_CFG(59, 3) }, // 4000 MHz VCO / 8
+};
+#define NUM_CORE_CLOCKS (sizeof(core_clocks) / sizeof(core_clocks[0]))
+
+// Test DDR on the U54 harts after it is trained: DDR_MEMTEST for a quick
+// test on every boot, DDR_MEMTEST_THOROUGH for burn-in
+#ifdef DDR_MEMTEST_THOROUGH
+  #define DDR_MEMTEST
+  #define DDR_MEMTEST_MODE MEMTEST_THOROUGH
+#else
+  #define DDR_MEMTEST_MODE MEMTEST_QUICK
+#endif
+
+// board_setup measures DDR bandwidth on the U54 harts with DDR_BENCH
+#ifndef BOARD_SETUP
+  #undef DDR_BENCH
+#endif
+// Zero all of DDR after training with DDR_SCRUB, as ECC parts need every
+// location written before it is read. The PDMA channels and the U54 harts
+// clear DDR_SCRUB_FIRST bytes at the payload and the DTB area before boot
+// goes on, and the rest while the payload loads, so the payload partition
+// must fit in DDR_SCRUB_FIRST.
+#ifdef DDR_SCRUB
+  #ifndef DDR_SCRUB_FIRST
+    #define DDR_SCRUB_FIRST (256UL * 1024UL * 1024UL)
+  #endif
+#endif
+
+#if defined(DDR_MEMTEST) || defined(DDR_BENCH) || defined(DDR_SCRUB)
+  #define MEMTEST_JOBS
+#endif
+
+// board_setup sweeps PHY delays and VREF around the trained values with
+// DDR_SHMOO. The fields moved are given as { register in the data slice,
+// lowest bit, width }, e.g. -DDDR_SHMOO_READ_DELAY="{ reg, shift, width }":
+// where they sit depends on the PHY release the register set was generated
+// for. Without DDR_SHMOO_VREF each eye is a single row.
+#ifndef BOARD_SETUP
+  #undef DDR_SHMOO
+#endif
+#ifdef DDR_SHMOO
+  #if !defined(DDR_SHMOO_READ_DELAY) && !defined(DDR_SHMOO_WRITE_DELAY)
+    #error "DDR_SHMOO needs DDR_SHMOO_READ_DELAY and/or DDR_SHMOO_WRITE_DELAY"
+  #endif
+  #ifndef DDR_SHMOO_DELAY_SPAN
+    #define DDR_SHMOO_DELAY_SPAN 32 // steps either side of the trained value
+  #endif
+  #ifndef DDR_SHMOO_VREF_SPAN
+    #define DDR_SHMOO_VREF_SPAN 8
+  #endif
+  #define DDR_SHMOO_SIZE (256UL * 1024UL * 1024UL) // tested per point; its lines overflow the L2
+#endif
+
 #ifndef PAYLOAD_DEST
   #define PAYLOAD_DEST MEMORY_MEM_ADDR
 #endif
@@ -51,11 +194,57 @@
   #define SPI_MEM_ADDR _SPI_MEM_ADDR(SPI_NUM)
 #endif
 
-Barrier barrier = { {0, 0}, {0, 0}, 0}; // bss initialization is done by main core while others do wfi
+Barrier barrier = { {0, 0}, {0, 0}, 0, {0, 0} }; // bss initialization is done by main core while others do wfi
+
+// Tasks for whichever harts are free, the U54s mostly; they take them
+// until the final barrier
+static WorkQueue workq;
+
+#ifdef MEMTEST_JOBS
+#define MEMTEST_JOB_SCRUB (-1) // mode that zeroes the span with a PDMA channel
+#define MEMTEST_JOBS_MAX (NUM_CORES - 1) // one per U54
+// Tests and benchmarks stay off the E51, which has no L1 D-cache
+#define MEMTEST_HARTS (((1UL << NUM_CORES) - 1) & ~(1UL << NONSMP_HART))
+
+struct memtest_job {
+  uintptr_t base;
+  uint64_t size;
+  int mode;
+  int channel;          // PDMA channel for MEMTEST_JOB_SCRUB
+  int hart;             // the hart that ran it
+  struct memtest_result result;
+};
+#if defined(DDR_MEMTEST) || defined(DDR_BENCH)
+static struct memtest_job memtest_jobs[MEMTEST_JOBS_MAX];
+#endif
+
+static void memtest_job_run(void *arg)
+{
+  struct memtest_job *job = arg;
+  job->hart = read_csr(mhartid);
+#ifdef DDR_SCRUB
+  if (job->mode == MEMTEST_JOB_SCRUB)
+    job->result.errors = ddrscrub_run(job->base, job->size, job->channel);
+  else
+#endif
+  memtest_run(job->base, job->size, job->mode, &job->result);
+}
+#endif
 
 extern const gpt_guid gpt_guid_sifive_bare_metal;
+extern const gpt_guid gpt_guid_sifive_fsbl_overlay;
+extern const gpt_guid gpt_guid_sifive_ddr_training;
 volatile uint64_t dtb_target;
+uint64_t ddr_size; // as probed
+unsigned int ddr_max_mts = ~0; // fastest DDR grade to try; patch to slow a board down
+unsigned int ddr_mts; // grade in use
+int ddr_read_interleave = DDR_AXI_READ_INTERLEAVE;
+int ddr_optimal_rmodw = DDR_OPTIMAL_RMODW;
+int ddr_train_attempts; // full trainings this boot; 0 when restored
+uint64_t ddr_failed_lanes; // DQ lanes left failing RX calibration
 unsigned int serial_to_burn = ~0;
+unsigned int core_max_mhz = CORE_MAX_MHZ; // fastest core clock to try
+unsigned int core_mhz; // core clock in use
 
 uint32_t __attribute__((weak)) own_dtb = 42; // not 0xedfe0dd0 the DTB magic
 
@@ -87,6 +276,42 @@ void handle_trap(uintptr_t sp)
 
 int slave_main(int id, unsigned long dtb);
 
+#if !defined(BOARD_SETUP) && !defined(SKIP_DTB_DDR_RANGE) && !defined(SKIP_DTB_OVERLAYS)
+/**
+ * Merge the overlays found at image into the DTB at dtb_target. Overlays
+ * are modified while being applied, so read-only ones are copied to
+ * scratch first. A rejected overlay may have been partly merged, so the
+ * DTB is saved in the top half of its reserved space before each one and
+ * put back on failure. Returns the number applied.
+ */
+static int apply_dtb_overlays(uintptr_t image, uintptr_t scratch)
+{
+  uintptr_t saved = dtb_target + DTB_RESERVED_SIZE / 2;
+  int applied = 0;
+  uint32_t size;
+
+  for (; (size = fdt_size(image)); image = (image + size + 7) & ~7UL) {
+    uintptr_t overlay = image;
+    if (scratch) {
+      memcpy((void*)scratch, (void*)image, size);
+      overlay = scratch;
+    }
+    if (fdt_size(dtb_target) > DTB_RESERVED_SIZE / 2) {
+      puts("\r\nDTB overlay skipped, no room");
+      continue;
+    }
+    memcpy((void*)saved, (void*)dtb_target, fdt_size(dtb_target));
+    if (fdt_overlay_apply(dtb_target, DTB_RESERVED_SIZE / 2, overlay) == 0) {
+      applied++;
+    } else {
+      memcpy((void*)dtb_target, (void*)saved, fdt_size(saved));
+      puts("\r\nDTB overlay rejected");
+    }
+  }
+  return applied;
+}
+#endif
+
 
 /**
  * Scale peripheral clock dividers before changing core PLL.
@@ -113,99 +338,44 @@ void update_peripheral_clock_dividers(unsigned int peripheral_input_khz)
   }
 }
 
-long nsec_per_cyc = 300; // 33.333MHz
-void nsleep(long nsec) {
-  long step = nsec_per_cyc*2; // 2 instructions per loop iteration
-  while (nsec > 0) nsec -= step;
-}
-
-int puts(const char * str){
-	uart_puts((void *) UART0_CTRL_ADDR, str);
-	return 1;
-}
-
-//HART 0 runs main
-
-int main(int id, unsigned long dtb)
+static uint32_t ddr_pllcfg(const struct ddr_grade *grade)
 {
-  // PRCI init
-
-  // Initialize UART divider for 33MHz core clock in case if trap is taken prior
-  // to core clock bump.
-  unsigned long long uart_target_hz = 115200ULL;
-  const uint32_t initial_core_clk_khz = 33000;
-  unsigned long peripheral_input_khz;
-  if (UX00PRCI_REG(UX00PRCI_CLKMUXSTATUSREG) & CLKMUX_STATUS_TLCLKSEL){
-    peripheral_input_khz = initial_core_clk_khz;
-  } else {
-    peripheral_input_khz = initial_core_clk_khz / 2;
-  }
-  UART0_REG(UART_REG_DIV) = uart_min_clk_divisor(peripheral_input_khz * 1000ULL, uart_target_hz);
-
-  // Check Reset Values (lock don't care)
-  uint32_t pll_default =
-    (PLL_R(PLL_R_default)) |
-    (PLL_F(PLL_F_default)) |
-    (PLL_Q(PLL_Q_default)) |
-    (PLL_RANGE(PLL_RANGE_default)) |
-    (PLL_BYPASS(PLL_BYPASS_default)) |
-    (PLL_FSE(PLL_FSE_default));
-  uint32_t lockmask = ~PLL_LOCK(1);
-  uint32_t pllout_default =
-    (PLLOUT_DIV(PLLOUT_DIV_default)) |
-    (PLLOUT_DIV_BY_1(PLLOUT_DIV_BY_1_default)) |
-    (PLLOUT_CLK_EN(PLLOUT_CLK_EN_default));
-
-  if ((UX00PRCI_REG(UX00PRCI_COREPLLCFG)     ^ pll_default) & lockmask) return (__LINE__);
-  if ((UX00PRCI_REG(UX00PRCI_COREPLLOUT)     ^ pllout_default))         return (__LINE__);
-  if ((UX00PRCI_REG(UX00PRCI_DDRPLLCFG)      ^ pll_default) & lockmask) return (__LINE__);
-  if ((UX00PRCI_REG(UX00PRCI_DDRPLLOUT)      ^ pllout_default))         return (__LINE__);
-  if (((UX00PRCI_REG(UX00PRCI_GEMGXLPLLCFG)) ^ pll_default) & lockmask) return (__LINE__);
-  if (((UX00PRCI_REG(UX00PRCI_GEMGXLPLLOUT)) ^ pllout_default))         return (__LINE__);
-
-  //CORE pll init
-  // If tlclksel is set for 2:1 operation,
-  // Set corepll 33Mhz -> 1GHz
-  // Otherwise, set corepll 33MHz -> 500MHz.
-  
-  if (UX00PRCI_REG(UX00PRCI_CLKMUXSTATUSREG) & CLKMUX_STATUS_TLCLKSEL){
-    nsec_per_cyc = 2;
-    peripheral_input_khz = 500000; // peripheral_clk = tlclk
-    update_peripheral_clock_dividers(peripheral_input_khz);
-    ux00prci_select_corepll_500MHz(&UX00PRCI_REG(UX00PRCI_CORECLKSELREG),
-                                   &UX00PRCI_REG(UX00PRCI_COREPLLCFG),
-                                   &UX00PRCI_REG(UX00PRCI_COREPLLOUT));
-  } else {
-    nsec_per_cyc = 1;
-    peripheral_input_khz = (1000000 / 2); // peripheral_clk = tlclk
-    update_peripheral_clock_dividers(peripheral_input_khz);
-    
-    ux00prci_select_corepll_1GHz(&UX00PRCI_REG(UX00PRCI_CORECLKSELREG),
-                                 &UX00PRCI_REG(UX00PRCI_COREPLLCFG),
-                                 &UX00PRCI_REG(UX00PRCI_COREPLLOUT));
-  }
-  
-  //
-  //DDR init
-  //
-
-  uint32_t ddrctlmhz =
+  return
     (PLL_R(0)) |
-    (PLL_F(DDRCTLPLL_F)) |
-    (PLL_Q(DDRCTLPLL_Q)) |
+    (PLL_F(grade->pll_f)) |
+    (PLL_Q(grade->pll_q)) |
     (PLL_RANGE(0x4)) |
     (PLL_BYPASS(0)) |
     (PLL_FSE(1));
-  UX00PRCI_REG(UX00PRCI_DDRPLLCFG) = ddrctlmhz;
+}
 
-  // Wait for lock
-  while ((UX00PRCI_REG(UX00PRCI_DDRPLLCFG) & PLL_LOCK(1)) == 0) ;
+/**
+ * Put the DDR controller and PHY through reset, clock them for grade and
+ * program them. The PHY is trained while the controller starts unless saved
+ * leveling results are given, which are programmed instead.
+ */
+static void ddr_bringup(const struct ddr_grade *grade, const struct ux00ddr_training *training)
+{
+  // Assert reset first, in case this is a retry
+  UX00PRCI_REG(UX00PRCI_DEVICESRESETREG) &= ~(DEVICESRESET_DDR_CTRL_RST_N(1) | DEVICESRESET_DDR_AXI_RST_N(1) | DEVICESRESET_DDR_AHB_RST_N(1) | DEVICESRESET_DDR_PHY_RST_N(1));
+  asm volatile ("fence");
+  for (int i = 0; i < 256; i++){
+    asm volatile ("nop");
+  }
 
+  // Gate the DDR clock while the PLL relocks at the grade's rate
   uint32_t ddrctl_out =
     (PLLOUT_DIV(PLLOUT_DIV_default)) |
     (PLLOUT_DIV_BY_1(PLLOUT_DIV_BY_1_default)) |
     (PLLOUT_CLK_EN(1));
-  (UX00PRCI_REG(UX00PRCI_DDRPLLOUT)) = ddrctl_out;
+  UX00PRCI_REG(UX00PRCI_DDRPLLOUT) = ddrctl_out & ~PLLOUT_CLK_EN(1);
+  UX00PRCI_REG(UX00PRCI_DDRPLLCFG) = ddr_pllcfg(grade);
+
+  // Wait for lock
+  while ((UX00PRCI_REG(UX00PRCI_DDRPLLCFG) & PLL_LOCK(1)) == 0) ;
+
+  UX00PRCI_REG(UX00PRCI_DDRPLLOUT) = ddrctl_out;
+  ddr_mts = grade->mts;
 
   //Release DDR reset.
   UX00PRCI_REG(UX00PRCI_DEVICESRESETREG) |= DEVICESRESET_DDR_CTRL_RST_N(1);
@@ -217,35 +387,624 @@ int main(int id, unsigned long dtb)
   for (int i = 0; i < 256; i++){
     asm volatile ("nop");
   }
-  
-  ux00ddr_writeregmap(UX00DDR_CTRL_ADDR,ddr_ctl_settings,ddr_phy_settings);
-  ux00ddr_disableaxireadinterleave(UX00DDR_CTRL_ADDR);
 
-  ux00ddr_disableoptimalrmodw(UX00DDR_CTRL_ADDR);  
-
-  ux00ddr_enablewriteleveling(UX00DDR_CTRL_ADDR);
-  ux00ddr_enablereadleveling(UX00DDR_CTRL_ADDR);
-  ux00ddr_enablereadlevelinggate(UX00DDR_CTRL_ADDR);
-  if(ux00ddr_getdramclass(UX00DDR_CTRL_ADDR) == DRAM_CLASS_DDR4)
-    ux00ddr_enablevreftraining(UX00DDR_CTRL_ADDR);
+#ifdef DDR_UNPACKED_TABLES
+  ux00ddr_writeregmap(UX00DDR_CTRL_ADDR,grade->ctl,grade->phy);
+#else
+  ux00ddr_writeregmap_packed(UX00DDR_CTRL_ADDR,grade->ctl,grade->phy);
+#endif
+  if (training)
+    ux00ddr_restore_training(UX00DDR_CTRL_ADDR, training);
+  if (!ddr_read_interleave)
+    ux00ddr_disableaxireadinterleave(UX00DDR_CTRL_ADDR);
+  if (!ddr_optimal_rmodw)
+    ux00ddr_disableoptimalrmodw(UX00DDR_CTRL_ADDR);
+
+  if (!training) {
+    ux00ddr_enablewriteleveling(UX00DDR_CTRL_ADDR);
+    ux00ddr_enablereadleveling(UX00DDR_CTRL_ADDR);
+    ux00ddr_enablereadlevelinggate(UX00DDR_CTRL_ADDR);
+    if(ux00ddr_getdramclass(UX00DDR_CTRL_ADDR) == DRAM_CLASS_DDR4)
+      ux00ddr_enablevreftraining(UX00DDR_CTRL_ADDR);
+  }
   //mask off interrupts for leveling completion
   ux00ddr_mask_leveling_completed_interrupt(UX00DDR_CTRL_ADDR);
 
   ux00ddr_mask_mc_init_complete_interrupt(UX00DDR_CTRL_ADDR);
   ux00ddr_mask_outofrange_interrupts(UX00DDR_CTRL_ADDR);
-  ux00ddr_setuprangeprotection(UX00DDR_CTRL_ADDR,DDR_SIZE);
+  ux00ddr_setuprangeprotection(UX00DDR_CTRL_ADDR,DDR_MAX_SIZE);
   ux00ddr_mask_port_command_error_interrupt(UX00DDR_CTRL_ADDR);
 
-  const uint64_t ddr_size = DDR_SIZE;
-  const uint64_t ddr_end = PAYLOAD_DEST + ddr_size;
-  ux00ddr_start(UX00DDR_CTRL_ADDR, PHYSICAL_FILTER_CTRL_ADDR, ddr_end);
+  ux00ddr_start(UX00DDR_CTRL_ADDR, PHYSICAL_FILTER_CTRL_ADDR, PAYLOAD_DEST + DDR_MAX_SIZE);
+}
 
-  ux00ddr_phy_fixup(UX00DDR_CTRL_ADDR); 
-  
-  //
-  //GEMGXL init
-  //
+/**
+ * Train DDR from scratch at the fastest grade ddr_max_mts allows, resetting
+ * the controller and training again while ux00ddr_phy_fixup() reports failing
+ * DQ lanes. After DDR_TRAIN_ATTEMPTS trainings at one grade, drop to the next.
+ */
+static const struct ddr_grade *ddr_train(void)
+{
+  const struct ddr_grade *grade;
+  int attempts;
+
+  UART0_REG(UART_REG_TXCTRL) = UART_TXEN; // ux00ddr_phy_fixup() reports lanes
+  for (grade = ddr_grades; grade < ddr_grades + NUM_DDR_GRADES; grade++) {
+    // The slowest grade is always tried
+    if (grade->mts > ddr_max_mts && grade + 1 < ddr_grades + NUM_DDR_GRADES) continue;
+    attempts = 0;
+    do {
+      ddr_bringup(grade, 0);
+      ddr_train_attempts++;
+      ddr_failed_lanes = ux00ddr_phy_fixup(UX00DDR_CTRL_ADDR);
+    } while (ddr_failed_lanes && ++attempts < DDR_TRAIN_ATTEMPTS);
+    if (!ddr_failed_lanes) return grade;
+  }
+#ifndef DDR_TRAIN_BEST_EFFORT
+  ux00boot_fail(ERROR_CODE_DDR_TRAINING_FAILED, 0);
+#endif
+  return grade - 1;
+}
+
+#if !defined(DDR_SIZE) || defined(DDR_TRAINING_CACHE)
+// Bytes of the cacheable zero device to read to displace every line of a
+// U54's 32 KiB 8-way L1 D-cache. Its replacement is random, so a line
+// survives each miss to its set with odds 7/8; 1 MiB is 256 misses per set.
+#define DDR_L1_EVICT_SIZE (1024UL * 1024UL)
+
+/**
+ * Push DDR lines written by this hart out to the DRAM and make its next
+ * reads of them come from the DRAM. There is no uncached alias of DDR, so
+ * the L1 is evicted first (writing back dirty lines into the L2, a no-op on
+ * the cacheless E51) and each line given is then flushed out of the L2.
+ */
+static void ddr_uncache(const uintptr_t *lines, int count)
+{
+  uintptr_t offset;
+
+  for (offset = 0; offset < DDR_L1_EVICT_SIZE; offset += 64)
+    (void)*(volatile uint64_t*)(CACHEABLE_ZERO_MEM_ADDR + offset);
+  asm volatile ("fence" ::: "memory");
+  for (int i = 0; i < count; i++) ccache_flush64(CCACHE_CTRL_ADDR, lines[i]);
+  asm volatile ("fence" ::: "memory");
+}
+#endif
+
+#ifndef DDR_SIZE
+/**
+ * Find how much of [base, base + max_size) is backed by DDR. The controller
+ * wraps addresses past the fitted capacity (including the chip select of a
+ * missing rank) back onto the start, so the first power-of-two offset whose
+ * write lands on base is the size. Both lines are pushed out of the caches
+ * so the DRAM itself is probed.
+ */
+static uint64_t ddr_detect_size(uintptr_t base, uint64_t max_size)
+{
+  volatile uint64_t *origin = (volatile uint64_t*)base;
+  uint64_t size;
+
+  *origin = DDR_PROBE_MARK;
+  ddr_uncache(&base, 1);
+  for (size = DDR_MIN_SIZE; size < max_size; size <<= 1) {
+    uintptr_t lines[2] = { base + size, base };
+    *(volatile uint64_t*)(base + size) = DDR_PROBE_MARK ^ size;
+    ddr_uncache(lines, 2);
+    if (*origin != DDR_PROBE_MARK) break;
+  }
+  return size;
+}
+#endif
+
+/**
+ * Size DDR once it is started and fence off the addresses it does not back.
+ */
+static uint64_t ddr_resize(void)
+{
+#ifdef DDR_SIZE
+  return DDR_SIZE;
+#else
+  uint64_t size = ddr_detect_size(PAYLOAD_DEST, DDR_MAX_SIZE);
+  if (size != DDR_MAX_SIZE) {
+    ux00ddr_setuprangeprotection(UX00DDR_CTRL_ADDR, size);
+    ux00ddr_setupbusblocker(PHYSICAL_FILTER_CTRL_ADDR, PAYLOAD_DEST + size);
+  }
+  return size;
+#endif
+}
+
+#ifdef DDR_TRAINING_CACHE
+static struct ux00ddr_training ddr_training;
+
+/**
+ * Identify the grade and settings a saved training belongs to, so a rebuilt
+ * FSBL with different DDR settings trains again.
+ */
+static uint32_t ddr_training_key(const struct ddr_grade *grade)
+{
+  uint32_t pllcfg = ddr_pllcfg(grade);
+  uint32_t key = ux00ddr_crc32(0, &pllcfg, sizeof(pllcfg));
+  key = ux00ddr_crc32(key, grade->ctl, grade->ctl_bytes);
+  key = ux00ddr_crc32(key, grade->phy, grade->phy_bytes);
+  return key;
+}
+
+/**
+ * The grade a saved training was made at, if ddr_max_mts still allows it.
+ */
+static const struct ddr_grade *ddr_training_grade(const struct ux00ddr_training *training)
+{
+  for (const struct ddr_grade *grade = ddr_grades; grade < ddr_grades + NUM_DDR_GRADES; grade++) {
+    if (grade->mts <= ddr_max_mts && ux00ddr_training_valid(training, ddr_training_key(grade)))
+      return grade;
+  }
+  return 0;
+}
+
+/**
+ * Write and read back one word at every power-of-two offset into DDR, then the
+ * same with the pattern inverted, pushing the lines out of the L1 and L2 in
+ * between so the DRAM itself is read. Returns nonzero on a mismatch.
+ */
+static int ddr_quick_check(uintptr_t base, uint64_t size)
+{
+  uintptr_t lines[64];
+
+  for (int pass = 0; pass < 2; pass++) {
+    uint64_t invert = pass ? ~0UL : 0;
+    uint64_t offset;
+    int count = 0;
+
+    for (offset = 0; offset < size; offset = offset ? offset << 1 : 64) {
+      *(volatile uint64_t*)(base + offset) = (0x5555aaaa00000000UL | (base + offset)) ^ invert;
+      lines[count++] = base + offset;
+    }
+    ddr_uncache(lines, count);
+    for (offset = 0; offset < size; offset = offset ? offset << 1 : 64) {
+      if (*(volatile uint64_t*)(base + offset) != ((0x5555aaaa00000000UL | (base + offset)) ^ invert))
+        return 1;
+    }
+  }
+  return 0;
+}
+#endif
+
+#if !defined(BOARD_SETUP) && !defined(SKIP_DTB_DDR_RANGE)
+/**
+ * Set a property of /chosen, creating the node if the DTB has none.
+ */
+static void chosen_setprop(uintptr_t fdt, const char *prop, const void *value, int len)
+{
+  fdt_add_node(fdt, DTB_RESERVED_SIZE, "/", "chosen");
+  fdt_setprop(fdt, DTB_RESERVED_SIZE, "/chosen", prop, value, len);
+}
+
+/**
+ * Record how DDR training went: the number of full trainings (0 when the
+ * cached results were used), the data rate in MT/s and any lanes left
+ * failing.
+ */
+static void ddr_training_dtb(uintptr_t fdt)
+{
+  uint32_t cells[2];
+
+  cells[0] = __builtin_bswap32(ddr_train_attempts);
+  chosen_setprop(fdt, "sifive,ddr-train-attempts", cells, sizeof(cells[0]));
+  cells[0] = __builtin_bswap32(ddr_mts);
+  chosen_setprop(fdt, "sifive,ddr-data-rate", cells, sizeof(cells[0]));
+  if (ddr_failed_lanes) {
+    cells[0] = __builtin_bswap32(ddr_failed_lanes >> 32);
+    cells[1] = __builtin_bswap32(ddr_failed_lanes);
+    chosen_setprop(fdt, "sifive,ddr-failed-lanes", cells, sizeof(cells));
+  }
+}
+#endif
+
+#ifdef DDR_MEMTEST
+/**
+ * Split [base, base + size) into shares for the U54 harts to test, wait for
+ * them and report each share with the hart that tested it.
+ */
+static void ddr_memtest(uintptr_t base, uint64_t size)
+{
+  void *uart = (void*)UART0_CTRL_ADDR;
+  uint64_t share = (size / MEMTEST_JOBS_MAX) & ~0xfffUL;
+  int i;
+
+  for (i = 0; i < MEMTEST_JOBS_MAX; i++) {
+    memtest_jobs[i].base = base + i * share;
+    memtest_jobs[i].size = share;
+    memtest_jobs[i].mode = DDR_MEMTEST_MODE;
+    WorkQueue_Submit_Harts(&workq, MEMTEST_HARTS, memtest_job_run, &memtest_jobs[i]);
+  }
+  WorkQueue_Wait_All(&workq, 1);
+
+  UART0_REG(UART_REG_TXCTRL) = UART_TXEN;
+  for (i = 0; i < MEMTEST_JOBS_MAX; i++) {
+    const struct memtest_result *result = &memtest_jobs[i].result;
+
+    // mtime counts microseconds, so bytes per tick is MB/s
+    uart_puts(uart, "\r\nDDR test hart ");
+    uart_put_dec(uart, memtest_jobs[i].hart);
+    uart_puts(uart, ", share ");
+    uart_put_dec(uart, i + 1);
+    uart_puts(uart, ": ");
+    uart_put_dec(uart, result->ticks ? result->bytes / result->ticks : 0);
+    uart_puts(uart, " MB/s");
+    if (result->errors) {
+      uart_puts(uart, ", ");
+      uart_put_dec(uart, result->errors);
+      uart_puts(uart, " errors from 0x");
+      uart_put_hex64(uart, result->fail_addr);
+      uart_puts(uart, ", lanes 0x");
+      uart_put_hex64(uart, result->lanes);
+    }
+  }
+}
+
+#if !defined(BOARD_SETUP) && !defined(SKIP_DTB_DDR_RANGE)
+/**
+ * Record the memory test results under /chosen: per-share bandwidth in MB/s
+ * and error counts, and when anything failed, the failing data lanes and the
+ * lowest failing address.
+ */
+static void ddr_memtest_dtb(uintptr_t fdt)
+{
+  uint32_t bandwidth[MEMTEST_JOBS_MAX], errors[MEMTEST_JOBS_MAX], cells[2];
+  uint64_t lanes = 0, fail_addr = ~0UL;
+
+  for (int i = 0; i < MEMTEST_JOBS_MAX; i++) {
+    const struct memtest_result *result = &memtest_jobs[i].result;
+    bandwidth[i] = __builtin_bswap32(result->ticks ? result->bytes / result->ticks : 0);
+    errors[i] = __builtin_bswap32(result->errors > ~0U ? ~0U : result->errors);
+    lanes |= result->lanes;
+    if (result->errors && result->fail_addr < fail_addr) fail_addr = result->fail_addr;
+  }
+
+  chosen_setprop(fdt, "sifive,memtest-bandwidth", bandwidth, sizeof(bandwidth));
+  chosen_setprop(fdt, "sifive,memtest-errors", errors, sizeof(errors));
+  if (lanes) {
+    cells[0] = __builtin_bswap32(lanes >> 32);
+    cells[1] = __builtin_bswap32(lanes);
+    chosen_setprop(fdt, "sifive,memtest-lanes", cells, sizeof(cells));
+    cells[0] = __builtin_bswap32(fail_addr >> 32);
+    cells[1] = __builtin_bswap32(fail_addr);
+    chosen_setprop(fdt, "sifive,memtest-fail-addr", cells, sizeof(cells));
+  }
+}
+#endif
+#endif
+
+#ifdef DDR_BENCH
+#define DDR_BENCH_SIZE (64UL * 1024UL * 1024UL) // per hart, well past the L2
+
+/**
+ * Time one bandwidth mode on harts U54s at once and return the MB/s they
+ * reach together. Hart 0 only hands out the work, so it does not skew it.
+ */
+static uint64_t ddr_bench_run(int mode, int harts)
+{
+  uint64_t bytes = 0, ticks, start;
+  int i;
+
+  start = clkutils_read_mtime();
+  for (i = 0; i < harts; i++) {
+    memtest_jobs[i].base = PAYLOAD_DEST + i * DDR_BENCH_SIZE;
+    memtest_jobs[i].size = DDR_BENCH_SIZE;
+    memtest_jobs[i].mode = mode;
+    WorkQueue_Submit_Harts(&workq, MEMTEST_HARTS, memtest_job_run, &memtest_jobs[i]);
+  }
+  WorkQueue_Wait_All(&workq, 0);
+  ticks = clkutils_read_mtime() - start;
+  for (i = 0; i < harts; i++) bytes += memtest_jobs[i].result.bytes;
+  // mtime counts microseconds, so bytes per tick is MB/s
+  return ticks ? bytes / ticks : 0;
+}
+
+/**
+ * Retrain DDR with each combination of AXI read interleave and optimal RMODW
+ * and print the read, write and copy bandwidth of one and of all U54 harts,
+ * one line per run:
+ *   bench interleave=<0|1> rmodw=<0|1> harts=<n> read=<MB/s> write=<MB/s> copy=<MB/s>
+ * The configured combination runs last and is left in place.
+ */
+static void ddr_bench(void)
+{
+  static const int modes[] = { MEMTEST_BENCH_READ, MEMTEST_BENCH_WRITE, MEMTEST_BENCH_COPY };
+  static const char *const names[] = { " read=", " write=", " copy=" };
+  static const int hart_counts[] = { 1, NUM_CORES - 1 };
+  void *uart = (void*)UART0_CTRL_ADDR;
+  int interleave = ddr_read_interleave, rmodw = ddr_optimal_rmodw;
+
+  for (int i = 3; i >= 0; i--) {
+    ddr_read_interleave = interleave ^ (i & 1);
+    ddr_optimal_rmodw = rmodw ^ (i >> 1);
+    ddr_train();
+    ddr_size = ddr_resize();
+    for (int h = 0; h < 2; h++) {
+      uart_puts(uart, "\r\nbench interleave=");
+      uart_put_dec(uart, ddr_read_interleave);
+      uart_puts(uart, " rmodw=");
+      uart_put_dec(uart, ddr_optimal_rmodw);
+      uart_puts(uart, " harts=");
+      uart_put_dec(uart, hart_counts[h]);
+      for (int m = 0; m < 3; m++) {
+        uart_puts(uart, names[m]);
+        uart_put_dec(uart, ddr_bench_run(modes[m], hart_counts[h]));
+      }
+    }
+  }
+  uart_puts(uart, "\r\n");
+}
+#endif
+
+#ifdef DDR_SHMOO
+static void put_offset(void *uart, int offset)
+{
+  if (offset < 0) uart_putc(uart, '-');
+  uart_put_dec(uart, offset < 0 ? -offset : offset);
+}
+
+/**
+ * Move delay (and vref, if given) by the same offsets in every data slice.
+ * Returns 0 when a slice would leave its field's range.
+ */
+static int ddr_shmoo_set(const struct ux00ddr_slice_field *delay, const uint32_t *delay_trained, int delay_offset,
+                         const struct ux00ddr_slice_field *vref, const uint32_t *vref_trained, int vref_offset)
+{
+  for (int slice = 0; slice < UX00DDR_DATA_SLICES; slice++) {
+    if ((int)delay_trained[slice] + delay_offset < 0 || delay_trained[slice] + delay_offset > ux00ddr_slice_field_max(delay)) return 0;
+    if (vref && ((int)vref_trained[slice] + vref_offset < 0 || vref_trained[slice] + vref_offset > ux00ddr_slice_field_max(vref))) return 0;
+  }
+  for (int slice = 0; slice < UX00DDR_DATA_SLICES; slice++) {
+    ux00ddr_set_slice_field(UX00DDR_CTRL_ADDR, slice, delay, delay_trained[slice] + delay_offset);
+    if (vref) ux00ddr_set_slice_field(UX00DDR_CTRL_ADDR, slice, vref, vref_trained[slice] + vref_offset);
+  }
+  asm volatile ("fence");
+  return 1;
+}
+
+/**
+ * Run a quick pattern test at each delay and VREF offset from the trained
+ * values and print the eye, one row per VREF offset:
+ *   shmoo <name> delay=<min>:<max> vref=<min>:<max>
+ *   shmoo <name> vref=<offset> <one of + pass, . fail, x out of range per delay offset>
+ *   shmoo <name> end
+ * The trained values are put back afterwards.
+ */
+static void ddr_shmoo(const char *name, const struct ux00ddr_slice_field *delay, const struct ux00ddr_slice_field *vref)
+{
+  void *uart = (void*)UART0_CTRL_ADDR;
+  uint32_t delay_trained[UX00DDR_DATA_SLICES], vref_trained[UX00DDR_DATA_SLICES];
+  int vref_span = vref ? DDR_SHMOO_VREF_SPAN : 0;
+  struct memtest_result result;
+
+  for (int slice = 0; slice < UX00DDR_DATA_SLICES; slice++) {
+    delay_trained[slice] = ux00ddr_get_slice_field(UX00DDR_CTRL_ADDR, slice, delay);
+    if (vref) vref_trained[slice] = ux00ddr_get_slice_field(UX00DDR_CTRL_ADDR, slice, vref);
+  }
+
+  uart_puts(uart, "\r\nshmoo ");
+  uart_puts(uart, name);
+  uart_puts(uart, " delay=");
+  put_offset(uart, -DDR_SHMOO_DELAY_SPAN);
+  uart_putc(uart, ':');
+  put_offset(uart, DDR_SHMOO_DELAY_SPAN);
+  uart_puts(uart, " vref=");
+  put_offset(uart, -vref_span);
+  uart_putc(uart, ':');
+  put_offset(uart, vref_span);
+  for (int v = -vref_span; v <= vref_span; v++) {
+    uart_puts(uart, "\r\nshmoo ");
+    uart_puts(uart, name);
+    uart_puts(uart, " vref=");
+    put_offset(uart, v);
+    uart_putc(uart, ' ');
+    for (int d = -DDR_SHMOO_DELAY_SPAN; d <= DDR_SHMOO_DELAY_SPAN; d++) {
+      if (!ddr_shmoo_set(delay, delay_trained, d, vref, vref_trained, v)) {
+        uart_putc(uart, 'x');
+        continue;
+      }
+      memtest_run(PAYLOAD_DEST, DDR_SHMOO_SIZE, MEMTEST_QUICK, &result);
+      uart_putc(uart, result.errors ? '.' : '+');
+    }
+  }
+  ddr_shmoo_set(delay, delay_trained, 0, vref, vref_trained, 0);
+  uart_puts(uart, "\r\nshmoo ");
+  uart_puts(uart, name);
+  uart_puts(uart, " end\r\n");
+}
+
+static void ddr_shmoo_all(void)
+{
+#ifdef DDR_SHMOO_VREF
+  static const struct ux00ddr_slice_field vref = DDR_SHMOO_VREF;
+  const struct ux00ddr_slice_field *vref_field = &vref;
+#else
+  const struct ux00ddr_slice_field *vref_field = 0;
+#endif
+#ifdef DDR_SHMOO_READ_DELAY
+  static const struct ux00ddr_slice_field read_delay = DDR_SHMOO_READ_DELAY;
+  ddr_shmoo("read", &read_delay, vref_field);
+#endif
+#ifdef DDR_SHMOO_WRITE_DELAY
+  static const struct ux00ddr_slice_field write_delay = DDR_SHMOO_WRITE_DELAY;
+  ddr_shmoo("write", &write_delay, vref_field);
+#endif
+}
+#endif
+
+#ifdef DDR_SCRUB
+// Kept apart from memtest_jobs, whose results go into the DTB while the
+// last scrub phase still runs
+static struct memtest_job scrub_jobs[MEMTEST_JOBS_MAX];
+
+// The background phase runs while BOOT_HART loads the payload, so it must
+// not end up on BOOT_HART's own queue runs between init steps
+#define SCRUB_BACKGROUND_HARTS (MEMTEST_HARTS & ~(1UL << BOOT_HART))
+#define SCRUB_BACKGROUND_JOBS (MEMTEST_JOBS_MAX - 1)
+
+/**
+ * Split [base, base + size) into jobs for the harts in a mask, each with its
+ * own PDMA channel.
+ */
+static void ddr_scrub_post(uintptr_t base, uint64_t size, unsigned long harts, int jobs)
+{
+  uint64_t share = (size / jobs) & ~0xfffUL;
+
+  for (int i = 0; i < jobs; i++) {
+    scrub_jobs[i].base = base + i * share;
+    scrub_jobs[i].size = i == jobs - 1 ? size - i * share : share;
+    scrub_jobs[i].mode = MEMTEST_JOB_SCRUB;
+    scrub_jobs[i].channel = i;
+    scrub_jobs[i].result.errors = 0;
+    WorkQueue_Submit_Harts(&workq, harts, memtest_job_run, &scrub_jobs[i]);
+  }
+}
+
+/**
+ * Wait for the posted jobs and report PDMA transfers that failed; their
+ * spans were cleared by the hart instead, so DDR is still all written.
+ */
+static void ddr_scrub_wait(void)
+{
+  uint32_t errors = 0;
+
+  WorkQueue_Wait_All(&workq, 1);
+  for (int i = 0; i < MEMTEST_JOBS_MAX; i++) {
+    errors += scrub_jobs[i].result.errors;
+    scrub_jobs[i].result.errors = 0;
+  }
+  if (errors) {
+    puts("\r\nDDR scrub PDMA errors, cleared by the CPU: ");
+    uart_put_dec((void*)UART0_CTRL_ADDR, errors);
+  }
+}
+
+/**
+ * Zero DDR: first the start of the payload and the DTB area at the top,
+ * which main() uses next, then the rest in the background.
+ */
+static void ddr_scrub(uint64_t size)
+{
+  uintptr_t top = PAYLOAD_DEST + size - DTB_RESERVED_SIZE;
+  uint64_t first = DDR_SCRUB_FIRST < top - PAYLOAD_DEST ? DDR_SCRUB_FIRST : top - PAYLOAD_DEST;
+
+  ddr_scrub_post(PAYLOAD_DEST, first, ~0UL, MEMTEST_JOBS_MAX);
+  ddr_scrub_wait();
+  ddr_scrub_post(top, DTB_RESERVED_SIZE, ~0UL, MEMTEST_JOBS_MAX);
+  ddr_scrub_wait();
+  ddr_scrub_post(PAYLOAD_DEST + first, top - PAYLOAD_DEST - first, SCRUB_BACKGROUND_HARTS, SCRUB_BACKGROUND_JOBS);
+}
+#endif
+
+
+static int core_on_pll(void)
+{
+  return UX00PRCI_REG(UX00PRCI_CORECLKSELREG) == PLL_CORECLKSEL_COREPLL;
+}
+
+/**
+ * The profile the core PLL was left running at by the ZSBL, if it is one of
+ * ours.
+ */
+static const struct core_clock *running_core_clock(void)
+{
+  if (!core_on_pll() || (UX00PRCI_REG(UX00PRCI_COREPLLCFG) & PLL_LOCK(1)) == 0) return 0;
+  for (const struct core_clock *clock = core_clocks; clock < core_clocks + NUM_CORE_CLOCKS; clock++) {
+    if ((UX00PRCI_REG(UX00PRCI_COREPLLCFG) & ~PLL_LOCK(1)) == clock->pllcfg) return clock;
+  }
+  return 0;
+}
+
+/**
+ * Run the core from the fastest PLL profile that locks, with the peripheral
+ * dividers rescaled before the switch. A profile the ZSBL already runs is
+ * kept as is. Returns the peripheral clock in kHz.
+ */
+static unsigned long select_core_clock(void)
+{
+  // TLCLKSEL set runs tlclk at the core clock, otherwise at half of it
+  int tl_1to1 = (UX00PRCI_REG(UX00PRCI_CLKMUXSTATUSREG) & CLKMUX_STATUS_TLCLKSEL) != 0;
+  const struct core_clock *running = running_core_clock();
+  uint32_t core_out =
+    (PLLOUT_DIV(PLLOUT_DIV_default)) |
+    (PLLOUT_DIV_BY_1(PLLOUT_DIV_BY_1_default)) |
+    (PLLOUT_CLK_EN(1));
+
+  for (const struct core_clock *clock = core_clocks; clock < core_clocks + NUM_CORE_CLOCKS; clock++) {
+    if (clock->mhz > core_max_mhz || (tl_1to1 && clock->mhz > TLCLK_MAX_MHZ)) continue;
+
+    if (clock != running && core_on_pll()) {
+      // Back to hfclk while the PLL relocks
+      UX00PRCI_REG(UX00PRCI_CORECLKSELREG) = PLL_CORECLKSEL_HFXIN;
+      running = 0;
+    }
+
+    // The core stays on hfclk until the PLL has locked
+    if (clock != running) {
+      UX00PRCI_REG(UX00PRCI_COREPLLCFG) = clock->pllcfg;
+      uint64_t deadline = clkutils_read_mtime() + CORE_PLL_LOCK_TIMEOUT_US * 1000 / RTC_PERIOD_NS;
+      while ((UX00PRCI_REG(UX00PRCI_COREPLLCFG) & PLL_LOCK(1)) == 0 && clkutils_read_mtime() < deadline) ;
+      if ((UX00PRCI_REG(UX00PRCI_COREPLLCFG) & PLL_LOCK(1)) == 0) continue;
+    }
+
+    unsigned long peripheral_input_khz = clock->mhz * 1000UL / (tl_1to1 ? 1 : 2); // peripheral_clk = tlclk
+    update_peripheral_clock_dividers(peripheral_input_khz);
+    UX00PRCI_REG(UX00PRCI_COREPLLOUT) = core_out;
+    UX00PRCI_REG(UX00PRCI_CORECLKSELREG) = PLL_CORECLKSEL_COREPLL;
+    clkutils_calibrate();
+    core_mhz = clock->mhz;
+    return peripheral_input_khz;
+  }
+  ux00boot_fail(ERROR_CODE_CORE_PLL_LOCK, 0);
+  return 0;
+}
+
+int puts(const char * str){
+	uart_puts((void *) UART0_CTRL_ADDR, str);
+	return 1;
+}
+
+//
+// Boot init runs as steps. Each step names the steps it needs and the hart
+// that runs it; harts claim any step that is ready for them as they come
+// free, so hardware waits overlap. Hart 0, the E51, brings the clocks up and
+// wakes BOOT_HART, a U54, for the heavy lifting. Small steps go to any hart.
+//
+enum {
+  INIT_CLOCK,     // core clock up, GEMGXL PLL started
+  INIT_DDR,       // train, size and test DDR, start scrubbing it
+  INIT_GEM,       // GEMGXL clock and reset, VSC8541 PHY reset
+  INIT_OTP,       // serial number and MAC address from OTP
+  INIT_BANNER,    // build info, DDR, clock and serial on the UART
+  INIT_DTB,       // copy, patch and overlay the DTB
+  INIT_PAYLOAD,   // load the boot payload
+  NUM_INIT_STEPS
+};
+#define INIT_STEP(n) (1U << (n))
+#define INIT_ALL     (INIT_STEP(NUM_INIT_STEPS) - 1)
+
+#define INIT_ANY_HART (-1)
 
+struct init_step {
+  void (*run)(void);    // 0 for a step this build leaves out
+  uint32_t deps;
+  int hart;             // the hart that runs it, or INIT_ANY_HART
+};
+
+static _Atomic uint32_t init_claimed, init_done;
+static unsigned long peripheral_khz;
+static uintptr_t dtb_source; // as handed over by the ZSBL, or ours
+static uint64_t phy_deadline;
+
+static void init_clock(void)
+{
+  // With tlclksel set for 1:1 operation the core runs at most 500MHz;
+  // otherwise as fast as core_max_mhz allows.
+  peripheral_khz = select_core_clock();
+
+  // The GEMGXL PLL locks and the PHY's 2ms reset pull-down runs out while
+  // DDR trains
   uint32_t gemgxl125mhz =
     (PLL_R(0)) |
     (PLL_F(59)) |  /*4000Mhz VCO*/
@@ -254,7 +1013,57 @@ int main(int id, unsigned long dtb)
     (PLL_BYPASS(0)) |
     (PLL_FSE(1));
   UX00PRCI_REG(UX00PRCI_GEMGXLPLLCFG) = gemgxl125mhz;
+  phy_deadline = clkutils_deadline_ns(2000000);
+
+  // Procmon => core clock
+  UX00PRCI_REG(UX00PRCI_PROCMONCFG) = 0x1 << 24;
+}
 
+static void init_ddr(void)
+{
+#ifdef DDR_TRAINING_CACHE
+  // Reuse the leveling results of an earlier boot when they are for one of
+  // our grades and DDR holds data with them; otherwise train and save
+  const struct ddr_grade *ddr_grade = 0;
+  int ddr_trained = 0;
+  if (!ux00boot_try_read_gpt_partition(&ddr_training, sizeof(ddr_training), &gpt_guid_sifive_ddr_training, peripheral_khz) &&
+      (ddr_grade = ddr_training_grade(&ddr_training))) {
+    ddr_bringup(ddr_grade, &ddr_training);
+    ddr_size = ddr_resize();
+    ddr_trained = !ddr_quick_check(PAYLOAD_DEST, ddr_size);
+  }
+  if (!ddr_trained) {
+    ddr_grade = ddr_train();
+    ddr_size = ddr_resize();
+    if (!ddr_failed_lanes) {
+      // The settings the PHY was programmed with, to tell what leveling changed
+#ifdef DDR_UNPACKED_TABLES
+      const uint32_t *physettings = ddr_grade->phy;
+#else
+      static uint32_t physettings[UX00DDR_PHY_REGS];
+      ddrpack_replay(physettings, ddr_grade->phy);
+#endif
+      ux00ddr_save_training(UX00DDR_CTRL_ADDR, &ddr_training, ddr_training_key(ddr_grade), physettings);
+      ux00boot_try_write_gpt_partition(&ddr_training, sizeof(ddr_training), &gpt_guid_sifive_ddr_training, peripheral_khz);
+    }
+  }
+#else
+  ddr_train();
+  ddr_size = ddr_resize();
+#endif
+#ifdef DDR_MEMTEST
+  ddr_memtest(PAYLOAD_DEST, ddr_size);
+#endif
+#ifdef DDR_SCRUB
+  ddr_scrub(ddr_size);
+#endif
+#ifndef BOARD_SETUP
+  dtb_target = PAYLOAD_DEST + ddr_size - DTB_RESERVED_SIZE;
+#endif
+}
+
+static void init_gem(void)
+{
   // Wait for lock
   while ((UX00PRCI_REG(UX00PRCI_GEMGXLPLLCFG) & PLL_LOCK(1)) == 0) ;
 
@@ -265,79 +1074,43 @@ int main(int id, unsigned long dtb)
   UX00PRCI_REG(UX00PRCI_GEMGXLPLLOUT) = gemgxlctl_out;
 
   //Release GEMGXL reset (set bit DEVICESRESET_GEMGXL to 1)
-  UX00PRCI_REG(UX00PRCI_DEVICESRESETREG) |= DEVICESRESET_GEMGXL_RST_N(1);
+  atomic_fetch_or((_Atomic uint32_t *)&UX00PRCI_REG(UX00PRCI_DEVICESRESETREG), DEVICESRESET_GEMGXL_RST_N(1));
 
 //#ifdef VSC8541_PHY
 #define PHY_NRESET 0x1000
 
   // VSC8541 PHY reset sequence; leave pull-down active for 2ms
-  nsleep(2000000);
+  clkutils_deadline_wait(phy_deadline);
   // Set GPIO 12 (PHY NRESET) to OE=1 and OVAL=1
   atomic_fetch_or(&GPIO_REG(GPIO_OUTPUT_VAL), PHY_NRESET);
   atomic_fetch_or(&GPIO_REG(GPIO_OUTPUT_EN),  PHY_NRESET);
-  nsleep(100);
+  clkutils_delay_ns(100);
   // Reset PHY again to enter unmanaged mode
   atomic_fetch_and(&GPIO_REG(GPIO_OUTPUT_VAL), ~PHY_NRESET);
-  nsleep(100);
+  clkutils_delay_ns(100);
   atomic_fetch_or(&GPIO_REG(GPIO_OUTPUT_VAL), PHY_NRESET);
-  nsleep(15000000);
+  // The PHY needs 15ms out of reset; boot goes on and waits before handoff
+  phy_deadline = clkutils_deadline_ns(15000000);
 //#endif
+}
 
-  // Procmon => core clock
-  UX00PRCI_REG(UX00PRCI_PROCMONCFG) = 0x1 << 24;
-
-#ifdef BOARD_SETUP
-  asm volatile ("ebreak");
-#else
-  // Copy the DTB and reduce the reported memory to match DDR
-  dtb_target = ddr_end - 0x200000; // - 2MB
-#ifndef SKIP_DTB_DDR_RANGE
-#define DEQ(mon, x) ((cdate[0] == mon[0] && cdate[1] == mon[1] && cdate[2] == mon[2]) ? x : 0)
-
-  const char *cdate = __DATE__;
-  int month =
-    DEQ("Jan", 1) | DEQ("Feb",  2) | DEQ("Mar",  3) | DEQ("Apr",  4) |
-    DEQ("May", 5) | DEQ("Jun",  6) | DEQ("Jul",  7) | DEQ("Aug",  8) |
-    DEQ("Sep", 9) | DEQ("Oct", 10) | DEQ("Nov", 11) | DEQ("Dec", 12);
+#if !defined(BOARD_SETUP) && !defined(SKIP_DTB_DDR_RANGE)
+static char build_date[11] = "YYYY-MM-DD";
 
-  char date[11] = "YYYY-MM-DD";
-  date[0] = cdate[7];
-  date[1] = cdate[8];
-  date[2] = cdate[9];
-  date[3] = cdate[10];
-  date[5] = '0' + (month/10);
-  date[6] = '0' + (month%10);
-  date[8] = cdate[4];
-  date[9] = cdate[5];
-
-  // Post the serial number and build info
-  extern const char * gitid;
-  UART0_REG(UART_REG_TXCTRL) = UART_TXEN;
-  
-  puts("\r\nSiFive FSBL:       ");
-  puts(date);
-  puts("-");
-  puts(gitid);
-  // If chiplink is connected and has a DTB, use that DTB instead of what we have
-  // compiled-in. This will be replaced with a real bootloader with overlays in
-  // the future
-  uint32_t *chiplink_dtb = (uint32_t*)0x2ff0000000UL;
-  if (*chiplink_dtb == 0xedfe0dd0){
-	dtb = (uintptr_t)chiplink_dtb;
-	puts("\r\nUsing Chiplink DTB");
-  } else if (own_dtb == 0xedfe0dd0){
-	dtb = (uintptr_t)&own_dtb;
-	puts("\r\nUsing FSBL DTB");
-  }
-  memcpy((void*)dtb_target, (void*)dtb, fdt_size(dtb));
-  fdt_reduce_mem(dtb_target, ddr_size); // reduce the RAM to physically present only
-  fdt_set_prop(dtb_target, "sifive,fsbl", (uint8_t*)&date[0]);
+// Runtime DTB fix-ups are queued here and applied while the DTB is copied
+static struct fdt_patch patches[2];
+static int num_patches;
 
 #ifndef SKIP_OTP_MAC
 #define FIRST_SLOT	0xfe
 #define LAST_SLOT	0x80
 
-  unsigned int serial = ~0;
+static unsigned int otp_serial = ~0; // as read, before any programming
+static unsigned int serial = ~0;
+static unsigned char mac[6];
+
+static void init_otp(void)
+{
   int serial_slot;
   ememory_otp_power_up_sequence();
   ememory_otp_begin_read();
@@ -349,20 +1122,14 @@ int main(int id, unsigned long dtb)
     if (pos == ~0 && neg == ~0) break; // empty slot encountered
   }
   ememory_otp_exit_read();
+  otp_serial = serial;
 
-  void *uart = (void*)UART0_CTRL_ADDR;
-  uart_puts(uart, "\r\nHiFive-U serial #: ");
-  uart_put_hex(uart, serial);
-
-  // Program the OTP?
+  // Program the OTP? This may run beside DDR training, so the banner
+  // reports it
   if (serial_to_burn != ~0 && serial != serial_to_burn && serial_slot > LAST_SLOT) {
-    uart_puts(uart, "Programming serial: ");
-    uart_put_hex(uart, serial_to_burn);
-    uart_puts(uart, "\r\n");
     ememory_otp_pgm_entry();
     if (serial != ~0) {
       // erase the current serial
-      uart_puts(uart, "Erasing prior serial\r\n");
       ememory_otp_pgm_access(serial_slot,   0);
       ememory_otp_pgm_access(serial_slot+1, 0);
       serial_slot -= 2;
@@ -370,28 +1137,265 @@ int main(int id, unsigned long dtb)
     ememory_otp_pgm_access(serial_slot,    serial_to_burn);
     ememory_otp_pgm_access(serial_slot+1, ~serial_to_burn);
     ememory_otp_pgm_exit();
-    uart_puts(uart, "Resuming boot\r\n");
     serial = serial_to_burn;
   }
 
   ememory_otp_power_down_sequence();
 
   // SiFive MA-S MAC block; default to serial 0
-  unsigned char mac[6] = { 0x70, 0xb3, 0xd5, 0x92, 0xf0, 0x00 };
+  static const unsigned char mac_base[6] = { 0x70, 0xb3, 0xd5, 0x92, 0xf0, 0x00 };
+  memcpy(mac, mac_base, sizeof(mac));
   if (serial != ~0) {
     mac[5] |= (serial >>  0) & 0xff;
     mac[4] |= (serial >>  8) & 0xff;
     mac[3] |= (serial >> 16) & 0xff;
   }
-  fdt_set_prop(dtb_target, "local-mac-address", &mac[0]);
+}
 #endif
-  uart_puts(uart, "\r\n");
+
+static void init_banner(void)
+{
+#define DEQ(mon, x) ((cdate[0] == mon[0] && cdate[1] == mon[1] && cdate[2] == mon[2]) ? x : 0)
+
+  const char *cdate = __DATE__;
+  int month =
+    DEQ("Jan", 1) | DEQ("Feb",  2) | DEQ("Mar",  3) | DEQ("Apr",  4) |
+    DEQ("May", 5) | DEQ("Jun",  6) | DEQ("Jul",  7) | DEQ("Aug",  8) |
+    DEQ("Sep", 9) | DEQ("Oct", 10) | DEQ("Nov", 11) | DEQ("Dec", 12);
+
+  build_date[0] = cdate[7];
+  build_date[1] = cdate[8];
+  build_date[2] = cdate[9];
+  build_date[3] = cdate[10];
+  build_date[5] = '0' + (month/10);
+  build_date[6] = '0' + (month%10);
+  build_date[8] = cdate[4];
+  build_date[9] = cdate[5];
+
+  // Post the serial number and build info
+  extern const char * gitid;
+  UART0_REG(UART_REG_TXCTRL) = UART_TXEN;
+  
+  puts("\r\nSiFive FSBL:       ");
+  puts(build_date);
+  puts("-");
+  puts(gitid);
+  puts("\r\nDDR size:          ");
+  uart_put_dec((void*)UART0_CTRL_ADDR, ddr_size >> 20);
+  puts(" MiB at ");
+  uart_put_dec((void*)UART0_CTRL_ADDR, ddr_mts);
+  puts(" MT/s");
+  if (ddr_train_attempts > 1) {
+    puts(", trained in ");
+    uart_put_dec((void*)UART0_CTRL_ADDR, ddr_train_attempts);
+    puts(" attempts");
+  }
+  puts("\r\nCore clock:        ");
+  uart_put_dec((void*)UART0_CTRL_ADDR, core_mhz);
+  puts(" MHz");
+  // If chiplink is connected and has a DTB, use that DTB instead of what we have
+  // compiled-in. This will be replaced with a real bootloader with overlays in
+  // the future
+  uint32_t *chiplink_dtb = (uint32_t*)0x2ff0000000UL;
+  if (*chiplink_dtb == 0xedfe0dd0){
+	dtb_source = (uintptr_t)chiplink_dtb;
+	puts("\r\nUsing Chiplink DTB");
+  } else if (own_dtb == 0xedfe0dd0){
+	dtb_source = (uintptr_t)&own_dtb;
+	puts("\r\nUsing FSBL DTB");
+  }
+#ifndef SKIP_OTP_MAC
+  void *uart = (void*)UART0_CTRL_ADDR;
+  uart_puts(uart, "\r\nHiFive-U serial #: ");
+  uart_put_hex(uart, otp_serial);
+  if (serial != otp_serial) {
+    uart_puts(uart, "Programming serial: ");
+    uart_put_hex(uart, serial);
+    uart_puts(uart, "\r\n");
+    if (otp_serial != ~0) uart_puts(uart, "Erasing prior serial\r\n");
+    uart_puts(uart, "Resuming boot\r\n");
+  }
 #endif
+}
 
-  puts("Loading boot payload");
-  ux00boot_load_gpt_partition((void*) PAYLOAD_DEST, &gpt_guid_sifive_bare_metal, peripheral_input_khz);
+static void init_dtb(void)
+{
+  uintptr_t dtb = dtb_source;
 
+  patches[num_patches++] = (struct fdt_patch) { 0, "sifive,fsbl", &build_date[0], sizeof(build_date) };
+#ifndef SKIP_OTP_MAC
+  patches[num_patches++] = (struct fdt_patch) { 0, "local-mac-address", &mac[0], sizeof(mac) };
+#endif
+  // Copy, patch, and reduce the RAM to physically present only; straight to the
+  // precomputed offsets when the DTB carries them, else in one streaming pass.
+  // Only our own DTB is built with a table (fsbl/dtb.S); nothing is known to
+  // follow a ChipLink or ZSBL one.
+  const struct fdt_locs *locs = dtb == (uintptr_t)&own_dtb ? fdt_locs_find(dtb) : 0;
+  if (fdt_copy_located(dtb_target, DTB_RESERVED_SIZE, dtb, locs, ddr_size, patches, num_patches) < 0 &&
+      fdt_copy(dtb_target, DTB_RESERVED_SIZE, dtb, ddr_size, patches, num_patches) < 0) {
+    // Not a layout fdt_copy() can stream, or nested too deep for its stack;
+    // copy it as is and fix up what the scanner can reach in place
+    memcpy((void*)dtb_target, (void*)dtb, fdt_size(dtb));
+    if (fdt_reduce_mem(dtb_target, ddr_size) < 0 || fdt_set_props(dtb_target, patches, num_patches) < 0)
+      puts("\r\nDTB nested too deep, not fully patched");
+  }
+
+#ifndef SKIP_DTB_OVERLAYS
+  // Payload memory is free until the payload is loaded; use it as scratch
+  int overlays = apply_dtb_overlays(CHIPLINK_OVERLAY_ADDR, PAYLOAD_DEST);
+  if (!ux00boot_try_load_gpt_partition((void*) PAYLOAD_DEST, &gpt_guid_sifive_fsbl_overlay, peripheral_khz))
+    overlays += apply_dtb_overlays(PAYLOAD_DEST, 0);
+  if (overlays) {
+    // The runtime fix-ups win over anything an overlay set
+    fdt_set_props(dtb_target, patches, num_patches);
+    fdt_reduce_mem(dtb_target, ddr_size);
+  }
+#endif
+  ddr_training_dtb(dtb_target);
+#ifdef DDR_MEMTEST
+  ddr_memtest_dtb(dtb_target);
+#endif
+  fdt_pack(dtb_target, DTB_RESERVED_SIZE); // hand off a minimal DTB
+  puts("\r\n");
+}
+#endif
+
+#ifndef BOARD_SETUP
+static void init_payload(void)
+{
+  puts("Loading boot payload");
+  ux00boot_load_gpt_partition((void*) PAYLOAD_DEST, &gpt_guid_sifive_bare_metal, peripheral_khz);
   puts("\r\n\n");
+}
+#endif
+
+static const struct init_step init_steps[NUM_INIT_STEPS] = {
+  [INIT_CLOCK]   = { init_clock, 0, NONSMP_HART },
+  [INIT_DDR]     = { init_ddr, INIT_STEP(INIT_CLOCK), BOOT_HART },
+  [INIT_GEM]     = { init_gem, INIT_STEP(INIT_CLOCK), INIT_ANY_HART },
+#if !defined(BOARD_SETUP) && !defined(SKIP_DTB_DDR_RANGE)
+#ifndef SKIP_OTP_MAC
+  [INIT_OTP]     = { init_otp, INIT_STEP(INIT_CLOCK), INIT_ANY_HART },
+#endif
+  [INIT_BANNER]  = { init_banner, INIT_STEP(INIT_DDR) | INIT_STEP(INIT_OTP), BOOT_HART },
+  [INIT_DTB]     = { init_dtb, INIT_STEP(INIT_BANNER), BOOT_HART },
+#endif
+#ifndef BOARD_SETUP
+  // The DTB step borrows the payload area as scratch
+  [INIT_PAYLOAD] = { init_payload, INIT_STEP(INIT_DDR) | INIT_STEP(INIT_DTB), BOOT_HART },
+#endif
+};
+
+/**
+ * Claim and run one step that is ready for this hart. Returns 0 if there
+ * was none.
+ */
+static int init_poll(int id)
+{
+  uint32_t done = atomic_load(&init_done);
+
+  for (int i = 0; i < NUM_INIT_STEPS; i++) {
+    const struct init_step *step = &init_steps[i];
+    if ((done & step->deps) != step->deps || (step->hart != id && step->hart != INIT_ANY_HART)) continue;
+    if (atomic_load(&init_claimed) & INIT_STEP(i)) continue;
+    if (atomic_fetch_or(&init_claimed, INIT_STEP(i)) & INIT_STEP(i)) continue;
+    if (step->run) step->run();
+    atomic_fetch_or(&init_done, INIT_STEP(i));
+    // Steps waiting on this one may now be ready
+    for (int hart = 0; hart < NUM_CORES; hart++) {
+      if (hart != id) Hart_Wake(hart);
+    }
+    return 1;
+  }
+  return 0;
+}
+
+static int init_finished(void)
+{
+  return atomic_load(&init_done) == INIT_ALL;
+}
+
+/**
+ * Run steps as they become ready for this hart, and queued tasks, until
+ * boot init is done, sleeping while there is nothing to do.
+ */
+static void init_help(int id)
+{
+  for (;;) {
+    Hart_Wake_Clear();
+    int busy = init_poll(id);
+    busy |= WorkQueue_Run(&workq);
+    if (init_finished()) return;
+    if (!busy) Hart_Sleep();
+  }
+}
+
+//HART 0 runs main
+
+int main(int id, unsigned long dtb)
+{
+  // PRCI init
+
+  // Initialize UART divider for 33MHz core clock, or the PLL clock the ZSBL
+  // left running, in case if trap is taken prior to core clock bump.
+  unsigned long long uart_target_hz = 115200ULL;
+  const struct core_clock *zsbl_clock = running_core_clock();
+  const uint32_t initial_core_clk_khz = zsbl_clock ? zsbl_clock->mhz * 1000 : 33000;
+  unsigned long peripheral_input_khz;
+  if (UX00PRCI_REG(UX00PRCI_CLKMUXSTATUSREG) & CLKMUX_STATUS_TLCLKSEL){
+    peripheral_input_khz = initial_core_clk_khz;
+  } else {
+    peripheral_input_khz = initial_core_clk_khz / 2;
+  }
+  UART0_REG(UART_REG_DIV) = uart_min_clk_divisor(peripheral_input_khz * 1000ULL, uart_target_hz);
+
+  // Check Reset Values (lock don't care)
+  uint32_t pll_default =
+    (PLL_R(PLL_R_default)) |
+    (PLL_F(PLL_F_default)) |
+    (PLL_Q(PLL_Q_default)) |
+    (PLL_RANGE(PLL_RANGE_default)) |
+    (PLL_BYPASS(PLL_BYPASS_default)) |
+    (PLL_FSE(PLL_FSE_default));
+  uint32_t lockmask = ~PLL_LOCK(1);
+  uint32_t pllout_default =
+    (PLLOUT_DIV(PLLOUT_DIV_default)) |
+    (PLLOUT_DIV_BY_1(PLLOUT_DIV_BY_1_default)) |
+    (PLLOUT_CLK_EN(PLLOUT_CLK_EN_default));
+
+  if (!zsbl_clock) {
+    if ((UX00PRCI_REG(UX00PRCI_COREPLLCFG)   ^ pll_default) & lockmask) return (__LINE__);
+    if ((UX00PRCI_REG(UX00PRCI_COREPLLOUT)   ^ pllout_default))         return (__LINE__);
+  }
+  if ((UX00PRCI_REG(UX00PRCI_DDRPLLCFG)      ^ pll_default) & lockmask) return (__LINE__);
+  if ((UX00PRCI_REG(UX00PRCI_DDRPLLOUT)      ^ pllout_default))         return (__LINE__);
+  if (((UX00PRCI_REG(UX00PRCI_GEMGXLPLLCFG)) ^ pll_default) & lockmask) return (__LINE__);
+  if (((UX00PRCI_REG(UX00PRCI_GEMGXLPLLOUT)) ^ pllout_default))         return (__LINE__);
+
+  //CORE pll init; finishing it wakes BOOT_HART for DDR init, GEMGXL init
+  //and the payload, and we help where we can
+  dtb_source = dtb;
+  // BOOT_HART is asleep in slave_main(), using the top of its stack only
+  for (uint64_t *p = _boot_stack_end; (uintptr_t)p < (uintptr_t)_boot_sp - 512; p++)
+    *p = BOOT_STACK_PAINT;
+  init_help(0);
+  for (int i = 0; i < BOOT_STACK_GUARD / 8; i++) {
+    if (_boot_stack_end[i] != BOOT_STACK_PAINT) ux00boot_fail(ERROR_CODE_BOOT_STACK_OVERFLOW, 0);
+  }
+  clkutils_deadline_wait(phy_deadline);
+#ifdef DDR_SCRUB
+  ddr_scrub_wait(); // the payload must not see the scrub still running
+#endif
+
+#ifdef BOARD_SETUP
+#ifdef DDR_BENCH
+  ddr_bench();
+#endif
+#ifdef DDR_SHMOO
+  ddr_shmoo_all();
+#endif
+  asm volatile ("ebreak");
+#else
   slave_main(0, dtb);
 #endif
 
@@ -407,25 +1411,30 @@ int main(int id, unsigned long dtb)
 
 int slave_main(int id, unsigned long dtb)
 {
+  // Help with boot init until it is done
+  init_help(id);
 #ifdef BOARD_SETUP
-  while (1)
-    ;
+  while (1) {
+    Hart_Wake_Clear();
+    if (!WorkQueue_Run(&workq)) Hart_Sleep();
+  }
 #else
-  // Wait for the DTB location to become known
-  while (!dtb_target) {}
+  // Tasks still queued, such as the rest of the DDR scrub
+  WorkQueue_Wait_All(&workq, 1);
 
   //wait on barrier, disable sideband then trap to payload at PAYLOAD_DEST
   write_csr(mtvec,PAYLOAD_DEST);
-
-  register int a0 asm("a0") = id;
 #ifdef SKIP_DTB_DDR_RANGE
-  register unsigned long a1 asm("a1") = dtb;
+  unsigned long arg = dtb;
 #else
-  register unsigned long a1 asm("a1") = dtb_target;
+  unsigned long arg = dtb_target;
 #endif
-  // These next two guys must get inlined and not spill a0+a1 or it is broken!
+  // These next two guys must get inlined; a0+a1 are set up after them so
+  // they cannot clobber them
   Barrier_Wait(&barrier, NUM_CORES);
   ccache_enable_ways(CCACHE_CTRL_ADDR,14);
+  register int a0 asm("a0") = id;
+  register unsigned long a1 asm("a1") = arg;
   asm volatile ("unimp" : : "r"(a0), "r"(a1));
 #endif
 
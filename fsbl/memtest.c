@@ -0,0 +1,162 @@
+/* Copyright (c) 2018 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/* See the file LICENSE for further information */
+
+#include <stdint.h>
+#include <string.h>
+#include <clkutils/clkutils.h>
+#include "fsbl/memtest.h"
+
+#define MEMTEST_PAGE_SHIFT 12
+#define MEMTEST_LINE_SHIFT 6
+
+struct memtest_span {
+  uintptr_t base;
+  uint64_t words;
+  uint64_t unit;        // bytes moved per word accessed
+  int mode;
+  struct memtest_result *result;
+};
+
+// The i-th word under test. Quick mode takes one per page, at a cache line
+// that moves through the page, so the column address bits still toggle.
+static inline volatile uint64_t *memtest_word(const struct memtest_span *span, uint64_t i)
+{
+  if (span->mode == MEMTEST_QUICK)
+    return (volatile uint64_t *)(span->base + (i << MEMTEST_PAGE_SHIFT) + ((i & 63) << MEMTEST_LINE_SHIFT));
+  return (volatile uint64_t *)(span->base + (i << 3));
+}
+
+static void memtest_fail(const struct memtest_span *span, volatile uint64_t *p, uint64_t got, uint64_t expect)
+{
+  struct memtest_result *result = span->result;
+  if (!result->errors++) result->fail_addr = (uintptr_t) p;
+  result->lanes |= got ^ expect;
+}
+
+#define MEMTEST_CHECK(span, p, expect) do { \
+    uint64_t got_ = *(p), expect_ = (expect); \
+    if (got_ != expect_) memtest_fail(span, p, got_, expect_); \
+  } while (0)
+
+// Every word holds its own address, or its complement
+static void memtest_address(const struct memtest_span *span, uint64_t invert)
+{
+  uint64_t i;
+  for (i = 0; i < span->words; i++) {
+    volatile uint64_t *p = memtest_word(span, i);
+    *p = (uintptr_t) p ^ invert;
+  }
+  for (i = 0; i < span->words; i++) {
+    volatile uint64_t *p = memtest_word(span, i);
+    MEMTEST_CHECK(span, p, (uintptr_t) p ^ invert);
+  }
+  span->result->bytes += 2 * span->words * span->unit;
+}
+
+// A single one (or zero) walks across the data lanes from word to word
+static void memtest_walk(const struct memtest_span *span, uint64_t invert)
+{
+  uint64_t i;
+  for (i = 0; i < span->words; i++) {
+    *memtest_word(span, i) = (1UL << (i & 63)) ^ invert;
+  }
+  for (i = 0; i < span->words; i++) {
+    MEMTEST_CHECK(span, memtest_word(span, i), (1UL << (i & 63)) ^ invert);
+  }
+  span->result->bytes += 2 * span->words * span->unit;
+}
+
+// Moving inversions: fill with the pattern, then check and invert upwards,
+// check and restore downwards, and check once more
+static void memtest_inversions(const struct memtest_span *span, uint64_t pattern)
+{
+  uint64_t i;
+  for (i = 0; i < span->words; i++) {
+    *memtest_word(span, i) = pattern;
+  }
+  for (i = 0; i < span->words; i++) {
+    volatile uint64_t *p = memtest_word(span, i);
+    MEMTEST_CHECK(span, p, pattern);
+    *p = ~pattern;
+  }
+  for (i = span->words; i-- > 0; ) {
+    volatile uint64_t *p = memtest_word(span, i);
+    MEMTEST_CHECK(span, p, ~pattern);
+    *p = pattern;
+  }
+  for (i = 0; i < span->words; i++) {
+    MEMTEST_CHECK(span, memtest_word(span, i), pattern);
+  }
+  span->result->bytes += 6 * span->words * span->unit;
+}
+
+// Keeps the sums of the read benchmark live
+static volatile uint64_t memtest_sink;
+
+// Stream through the span eight words at a time; each word moves once, or
+// once each way for a copy
+static void memtest_bench(uintptr_t base, uint64_t size, int mode, struct memtest_result *result)
+{
+  uint64_t *p = (uint64_t *) base, *q = (uint64_t *) (base + size / 2);
+  uint64_t words = size >> 3, sum = 0, i;
+
+  switch (mode) {
+    case MEMTEST_BENCH_READ:
+      for (i = 0; i < words; i += 8)
+        sum += p[i] + p[i+1] + p[i+2] + p[i+3] + p[i+4] + p[i+5] + p[i+6] + p[i+7];
+      memtest_sink = sum;
+      break;
+    case MEMTEST_BENCH_WRITE:
+      for (i = 0; i < words; i += 8) {
+        p[i] = i;   p[i+1] = i; p[i+2] = i; p[i+3] = i;
+        p[i+4] = i; p[i+5] = i; p[i+6] = i; p[i+7] = i;
+      }
+      break;
+    case MEMTEST_BENCH_COPY:
+      for (i = 0; i < words / 2; i += 8) {
+        q[i] = p[i];     q[i+1] = p[i+1]; q[i+2] = p[i+2]; q[i+3] = p[i+3];
+        q[i+4] = p[i+4]; q[i+5] = p[i+5]; q[i+6] = p[i+6]; q[i+7] = p[i+7];
+      }
+      break;
+  }
+  asm volatile ("fence" ::: "memory");
+  result->bytes = size;
+}
+
+void memtest_run(uintptr_t base, uint64_t size, int mode, struct memtest_result *result)
+{
+  struct memtest_span span;
+  uint64_t start;
+
+  memset(result, 0, sizeof(*result));
+  if (mode >= MEMTEST_BENCH_READ) {
+    start = clkutils_read_mtime();
+    memtest_bench(base, size, mode, result);
+    result->ticks = clkutils_read_mtime() - start;
+    return;
+  }
+
+  span.base = base;
+  span.mode = mode;
+  span.result = result;
+  if (mode == MEMTEST_QUICK) {
+    span.words = size >> MEMTEST_PAGE_SHIFT;
+    span.unit = 1UL << MEMTEST_LINE_SHIFT; // each word costs a whole line
+  } else {
+    span.words = size >> 3;
+    span.unit = sizeof(uint64_t);
+  }
+
+  start = clkutils_read_mtime();
+  memtest_address(&span, 0);
+  memtest_walk(&span, 0);
+  if (mode == MEMTEST_THOROUGH) {
+    memtest_address(&span, ~0UL);
+    memtest_walk(&span, ~0UL);
+    memtest_inversions(&span, 0);
+    memtest_inversions(&span, 0x5555555555555555UL);
+  }
+  result->ticks = clkutils_read_mtime() - start;
+}
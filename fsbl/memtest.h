@@ -0,0 +1,38 @@
+/* Copyright (c) 2018 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/* See the file LICENSE for further information */
+
+#ifndef _SIFIVE_MEMTEST_H
+#define _SIFIVE_MEMTEST_H
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+
+// Quick mode tests one word per 4 KiB page with address-in-address and
+// walking ones; thorough mode tests every word and adds walking zeros and
+// moving inversions
+#define MEMTEST_QUICK     0
+#define MEMTEST_THOROUGH  1
+// Bandwidth modes time streaming reads, writes or a copy from the lower to
+// the upper half and check nothing
+#define MEMTEST_BENCH_READ  2
+#define MEMTEST_BENCH_WRITE 3
+#define MEMTEST_BENCH_COPY  4
+
+struct memtest_result {
+  uint64_t bytes;       // bytes moved to and from DDR
+  uint64_t ticks;       // mtime ticks taken
+  uint64_t errors;      // failing reads
+  uint64_t fail_addr;   // first failing address
+  uint64_t lanes;       // data bits that read back wrong anywhere
+};
+
+// Test or time [base, base + size), which must be a multiple of 4 KiB; the
+// contents are lost
+void memtest_run(uintptr_t base, uint64_t size, int mode, struct memtest_result *result);
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _SIFIVE_MEMTEST_H */
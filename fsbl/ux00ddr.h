@@ -14,6 +14,7 @@
 #include <unistd.h>
 #include <uart/uart.h>
 #include <sifive/platform.h>
+#include "fsbl/ddrpack.h"
 
 #define _REG32(p, i) (*(volatile uint32_t *)((p) + (i)))
 
@@ -66,6 +67,22 @@ static inline void ux00ddr_writeregmap(size_t ahbregaddr, const uint32_t *ctlset
   phy_reset(ddrphyreg, physettings);
 }
 
+// As ux00ddr_writeregmap(), from the streams fsbl/ddrpack generates
+static inline void ux00ddr_writeregmap_packed(size_t ahbregaddr, const uint32_t *ctlstream, const uint32_t *phystream) {
+  volatile uint32_t *ddrctlreg = (volatile uint32_t *) ahbregaddr;
+  volatile uint32_t *ddrphyreg = ((volatile uint32_t *) ahbregaddr) + (0x2000 / sizeof(uint32_t));
+
+  ddrpack_replay(ddrctlreg, ctlstream);
+  ddrpack_replay(ddrphyreg, phystream);
+}
+
+// Open the BusBlocker in front of the controller AXI slave ports up to ddrend
+static inline void ux00ddr_setupbusblocker(size_t filteraddr, size_t ddrend) {
+  volatile uint64_t *filterreg = (volatile uint64_t *)filteraddr;
+  filterreg[0] = 0x0f00000000000000UL | (ddrend >> 2);
+  //                ^^ RWX + TOR
+}
+
 static inline void ux00ddr_start(size_t ahbregaddr, size_t filteraddr, size_t ddrend) {
   // START register at ddrctl register base offset 0
   uint32_t regdata = _REG32(0<<2, ahbregaddr);
@@ -74,10 +91,7 @@ static inline void ux00ddr_start(size_t ahbregaddr, size_t filteraddr, size_t dd
   // WAIT for initialization complete : bit 8 of INT_STATUS (DENALI_CTL_132) 0x210
   while ((_REG32(132<<2, ahbregaddr) & (1<<MC_INIT_COMPLETE_OFFSET)) == 0) {}
 
-  // Disable the BusBlocker in front of the controller AXI slave ports
-  volatile uint64_t *filterreg = (volatile uint64_t *)filteraddr;
-  filterreg[0] = 0x0f00000000000000UL | (ddrend >> 2);
-  //                ^^ RWX + TOR
+  ux00ddr_setupbusblocker(filteraddr, ddrend);
 }
 
 static inline void ux00ddr_mask_mc_init_complete_interrupt(size_t ahbregaddr) {
@@ -149,6 +163,98 @@ static inline uint32_t ux00ddr_getdramclass(size_t ahbregaddr) {
   return ((_REG32(0, ahbregaddr) >> DRAM_CLASS_OFFSET) & 0xF);
 }
 
+#define UX00DDR_PHY_REGS                    1215
+#define UX00DDR_TRAINING_MAGIC              0x4d524444 // "DDRM"
+
+// PHY state after leveling, as kept in the DDR training partition. The
+// leveling results are spread over the data and address slices, so the whole
+// PHY register file is saved, along with which bits of it leveling changed;
+// only those are restored, leaving trigger and self-clearing bits as the
+// register map programs them. Padded to whole 512-byte blocks.
+struct ux00ddr_training {
+  uint32_t magic;
+  uint32_t key;       // ux00ddr_crc32() of the settings the PHY was trained with
+  uint32_t crc;       // ux00ddr_crc32() of phy[] and mask[]
+  uint32_t reserved;
+  uint32_t phy[UX00DDR_PHY_REGS];
+  uint32_t mask[UX00DDR_PHY_REGS];
+  uint32_t pad[126];
+};
+_Static_assert(sizeof(struct ux00ddr_training) % 512 == 0, "struct ux00ddr_training must be whole blocks");
+
+static inline uint32_t ux00ddr_crc32(uint32_t crc, const void *buf, size_t len) {
+  const uint8_t *p = (const uint8_t *) buf;
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320U & -(crc & 1));
+  }
+  return ~crc;
+}
+
+// Save the PHY state after leveling. physettings are the values the PHY was
+// programmed with before it; the bits that differ are the leveling results.
+static inline void ux00ddr_save_training(size_t ahbregaddr, struct ux00ddr_training *training, uint32_t key,
+                                         const uint32_t *physettings) {
+  volatile uint32_t *ddrphyreg = ((volatile uint32_t *) ahbregaddr) + (0x2000 / sizeof(uint32_t));
+
+  for (unsigned int i = 0; i < UX00DDR_PHY_REGS; i++) {
+    training->phy[i] = ddrphyreg[i];
+    training->mask[i] = training->phy[i] ^ physettings[i];
+  }
+  training->magic = UX00DDR_TRAINING_MAGIC;
+  training->key = key;
+  training->crc = ux00ddr_crc32(0, training->phy, sizeof(training->phy) + sizeof(training->mask));
+  training->reserved = 0;
+}
+
+static inline bool ux00ddr_training_valid(const struct ux00ddr_training *training, uint32_t key) {
+  return training->magic == UX00DDR_TRAINING_MAGIC &&
+         training->key == key &&
+         training->crc == ux00ddr_crc32(0, training->phy, sizeof(training->phy) + sizeof(training->mask));
+}
+
+// Program the PHY with saved leveling results instead of training it. Runs
+// after the register map, so only the bits leveling changed are rewritten,
+// and only in the registers that have any.
+static inline void ux00ddr_restore_training(size_t ahbregaddr, const struct ux00ddr_training *training) {
+  volatile uint32_t *ddrphyreg = ((volatile uint32_t *) ahbregaddr) + (0x2000 / sizeof(uint32_t));
+
+  for (unsigned int i = 0; i < UX00DDR_PHY_REGS; i++) {
+    uint32_t mask = training->mask[i];
+    if (mask) ddrphyreg[i] = (ddrphyreg[i] & ~mask) | (training->phy[i] & mask);
+  }
+}
+
+#define UX00DDR_DATA_SLICES 8
+#define UX00DDR_SLICE_REGS  128
+
+// A field every PHY data slice has: register within the slice, lowest bit
+// and width
+struct ux00ddr_slice_field {
+  uint16_t reg;
+  uint8_t shift;
+  uint8_t width;
+};
+
+static inline uint32_t ux00ddr_slice_field_max(const struct ux00ddr_slice_field *field) {
+  return (1U << field->width) - 1;
+}
+
+static inline uint32_t ux00ddr_get_slice_field(size_t ahbregaddr, uint32_t slice, const struct ux00ddr_slice_field *field) {
+  size_t ddrphyreg = ahbregaddr + 0x2000;
+  uint32_t reg = _REG32((slice * UX00DDR_SLICE_REGS + field->reg) << 2, ddrphyreg);
+  return (reg >> field->shift) & ux00ddr_slice_field_max(field);
+}
+
+static inline void ux00ddr_set_slice_field(size_t ahbregaddr, uint32_t slice, const struct ux00ddr_slice_field *field, uint32_t value) {
+  size_t ddrphyreg = ahbregaddr + 0x2000;
+  uint32_t mask = ux00ddr_slice_field_max(field) << field->shift;
+  uint32_t reg = _REG32((slice * UX00DDR_SLICE_REGS + field->reg) << 2, ddrphyreg);
+  _REG32((slice * UX00DDR_SLICE_REGS + field->reg) << 2, ddrphyreg) = (reg & ~mask) | ((value << field->shift) & mask);
+}
+
 static inline uint64_t ux00ddr_phy_fixup(size_t ahbregaddr) {
   // return bitmask of failed lanes
 
@@ -181,14 +287,14 @@ static inline uint64_t ux00ddr_phy_fixup(size_t ahbregaddr) {
         // print error message on failure
         if (failc0 || failc1) {
           if (fails==0) uart_puts((void*) UART0_CTRL_ADDR, "DDR error in fixing up \n");
-          fails |= (1<<dq);
+          fails |= (1ULL<<dq);
           char slicelsc = '0';
           char slicemsc = '0';
           slicelsc += (dq % 10);
           slicemsc += (dq / 10);
           uart_puts((void*) UART0_CTRL_ADDR, "S ");
-          uart_puts((void*) UART0_CTRL_ADDR, &slicemsc);
-          uart_puts((void*) UART0_CTRL_ADDR, &slicelsc);
+          uart_putc((void*) UART0_CTRL_ADDR, slicemsc);
+          uart_putc((void*) UART0_CTRL_ADDR, slicelsc);
           if (failc0) uart_puts((void*) UART0_CTRL_ADDR, "U");
           else uart_puts((void*) UART0_CTRL_ADDR, "D");
           uart_puts((void*) UART0_CTRL_ADDR, "\n");
@@ -198,7 +304,7 @@ static inline uint64_t ux00ddr_phy_fixup(size_t ahbregaddr) {
     }
     slicebase+=128;
   }
-  return (0);
+  return fails;
 }
 
 #endif
@@ -39,6 +39,14 @@ const gpt_guid gpt_guid_sifive_fsbl = {{
 const gpt_guid gpt_guid_sifive_bare_metal = {{
   0x53, 0xb3, 0x54, 0x2e, 0x71, 0x12, 0x42, 0x48, 0x80, 0x6f, 0xe4, 0x36, 0xd6, 0xaf, 0x69, 0x85
 }};
+// d6e104f5-5128-4a7b-b3d3-9d4e50615ae0
+const gpt_guid gpt_guid_sifive_fsbl_overlay = {{
+  0xf5, 0x04, 0xe1, 0xd6, 0x28, 0x51, 0x7b, 0x4a, 0xb3, 0xd3, 0x9d, 0x4e, 0x50, 0x61, 0x5a, 0xe0
+}};
+// da2ea15e-867c-4ae0-9b3b-b20f66031415
+const gpt_guid gpt_guid_sifive_ddr_training = {{
+  0x5e, 0xa1, 0x2e, 0xda, 0x7c, 0x86, 0xe0, 0x4a, 0x9b, 0x3b, 0xb2, 0x0f, 0x66, 0x03, 0x14, 0x15
+}};
 
 
 static inline bool guid_equal(const gpt_guid* a, const gpt_guid* b)
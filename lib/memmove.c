@@ -0,0 +1,54 @@
+/* Copyright (c) 2018 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/* See the file LICENSE for further information */
+
+#include <string.h>
+#include <stdint.h>
+
+void *
+memmove(void *aa, const void *bb, size_t n)
+{
+  char *a = (char *)aa;
+  const char *b = (const char *)bb;
+  uintptr_t msk = sizeof (long) - 1;
+  int wide = (((uintptr_t)a ^ (uintptr_t)b) & msk) == 0;
+
+  if (a == b || n == 0)
+    return aa;
+
+  if (a < b || a >= b + n)
+    {
+      // Forward copy; the destination never overtakes the source
+      while (n && ((uintptr_t)a & msk))
+	*a++ = *b++, n--;
+      if (wide)
+	for (; n >= sizeof (long); n -= sizeof (long))
+	  {
+	    *(long *)a = *(const long *)b;
+	    a += sizeof (long);
+	    b += sizeof (long);
+	  }
+      while (n--)
+	*a++ = *b++;
+    }
+  else
+    {
+      // Backward copy for a destination overlapping the tail of the source
+      a += n;
+      b += n;
+      while (n && ((uintptr_t)a & msk))
+	*--a = *--b, n--;
+      if (wide)
+	for (; n >= sizeof (long); n -= sizeof (long))
+	  {
+	    a -= sizeof (long);
+	    b -= sizeof (long);
+	    *(long *)a = *(const long *)b;
+	  }
+      while (n--)
+	*--a = *--b;
+    }
+
+  return aa;
+}
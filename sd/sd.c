@@ -13,12 +13,16 @@
 #define SD_CMD_STOP_TRANSMISSION 12
 #define SD_CMD_SET_BLOCKLEN 16
 #define SD_CMD_READ_BLOCK_MULTIPLE 18
+#define SD_CMD_WRITE_BLOCK 24
 #define SD_CMD_APP_SEND_OP_COND 41
 #define SD_CMD_APP_CMD 55
 #define SD_CMD_READ_OCR 58
 #define SD_RESPONSE_IDLE 0x1
 // Data token for commands 17, 18, 24
 #define SD_DATA_TOKEN 0xfe
+// Data response token after a written block: xxx0sss1, sss = 010 accepted
+#define SD_DATA_RESPONSE_MASK 0x1f
+#define SD_DATA_ACCEPTED 0x05
 
 
 // SD card initialization must happen at 100-400kHz
@@ -213,6 +217,18 @@ static uint16_t crc16(uint16_t crc, uint8_t data)
 }
 
 
+static uint8_t sd_cmd_crc(uint8_t cmd, uint32_t arg)
+{
+  uint8_t crc = 0;
+  crc = crc7(crc, cmd);
+  crc = crc7(crc, arg >> 24);
+  crc = crc7(crc, (arg >> 16) & 0xff);
+  crc = crc7(crc, (arg >> 8) & 0xff);
+  crc = crc7(crc, arg & 0xff);
+  return (crc << 1) | 1;
+}
+
+
 int sd_init(spi_ctrl* spi, unsigned int input_clk_khz, int skip_sd_init_commands)
 {
   // Skip SD initialization commands if already done earlier and only set the
@@ -237,13 +253,7 @@ int sd_copy(spi_ctrl* spi, void* dst, uint32_t src_lba, size_t size)
   long i = size;
   int rc = 0;
 
-  uint8_t crc = 0;
-  crc = crc7(crc, SD_CMD(SD_CMD_READ_BLOCK_MULTIPLE));
-  crc = crc7(crc, src_lba >> 24);
-  crc = crc7(crc, (src_lba >> 16) & 0xff);
-  crc = crc7(crc, (src_lba >> 8) & 0xff);
-  crc = crc7(crc, src_lba & 0xff);
-  crc = (crc << 1) | 1;
+  uint8_t crc = sd_cmd_crc(SD_CMD(SD_CMD_READ_BLOCK_MULTIPLE), src_lba);
   if (sd_cmd(spi, SD_CMD(SD_CMD_READ_BLOCK_MULTIPLE), src_lba, crc) != 0x00) {
     sd_cmd_end(spi);
     return SD_COPY_ERROR_CMD18;
@@ -277,3 +287,42 @@ int sd_copy(spi_ctrl* spi, void* dst, uint32_t src_lba, size_t size)
   sd_cmd_end(spi);
   return rc;
 }
+
+
+/**
+ * Write size 512-byte blocks from src, one CMD24 per block.
+ */
+int sd_write(spi_ctrl* spi, const void* src, uint32_t dst_lba, size_t size)
+{
+  const uint8_t *p = src;
+
+  for (; size > 0; size--, dst_lba++) {
+    uint16_t crc = 0;
+    uint8_t response;
+    long n;
+
+    if (sd_cmd(spi, SD_CMD(SD_CMD_WRITE_BLOCK), dst_lba, sd_cmd_crc(SD_CMD(SD_CMD_WRITE_BLOCK), dst_lba)) != 0x00) {
+      sd_cmd_end(spi);
+      return SD_WRITE_ERROR_CMD24;
+    }
+    sd_dummy(spi); // at least one byte between the response and the data token
+    spi_txrx(spi, SD_DATA_TOKEN);
+    n = 512;
+    do {
+      uint8_t x = *p++;
+      spi_txrx(spi, x);
+      crc = crc16(crc, x);
+    } while (--n > 0);
+    spi_txrx(spi, crc >> 8);
+    spi_txrx(spi, crc & 0xff);
+
+    response = sd_dummy(spi) & SD_DATA_RESPONSE_MASK;
+    // The card holds DO low while it programs the block
+    while (sd_dummy(spi) == 0x00);
+    sd_cmd_end(spi);
+    if (response != SD_DATA_ACCEPTED) {
+      return SD_WRITE_ERROR_CMD24_DATA;
+    }
+  }
+  return 0;
+}
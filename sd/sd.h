@@ -15,6 +15,9 @@
 #define SD_COPY_ERROR_CMD18 1
 #define SD_COPY_ERROR_CMD18_CRC 2
 
+#define SD_WRITE_ERROR_CMD24 1
+#define SD_WRITE_ERROR_CMD24_DATA 2
+
 #ifndef __ASSEMBLER__
 
 #include <spi/spi.h>
@@ -23,6 +26,7 @@
 
 int sd_init(spi_ctrl* spi, unsigned int input_clk_hz, int skip_sd_init_commands);
 int sd_copy(spi_ctrl* spi, void* dst, uint32_t src_lba, size_t size);
+int sd_write(spi_ctrl* spi, const void* src, uint32_t dst_lba, size_t size);
 
 #endif /* !__ASSEMBLER__ */
 
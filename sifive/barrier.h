@@ -7,6 +7,34 @@
 #define SIFIVE_BARRIER
 
 #include <stdatomic.h>
+#include "encoding.h"
+#include <sifive/platform.h>
+
+/********** Hart sleep and wake-up **********/
+// A hart sleeps in wfi until another hart raises its CLINT software
+// interrupt (MSIP). This needs MSIE set in mie, as smp_pause leaves it, and
+// interrupts off in mstatus, so the interrupt only ends the wfi.
+
+// Wake a hart after publishing what it should see
+static inline void Hart_Wake(int hart)
+{
+  asm volatile ("fence" ::: "memory");
+  CLINT_REG(CLINT_MSIP + hart * CLINT_MSIP_size) = 1;
+}
+
+// Forget earlier wake-ups; check for work after this, and sleep if there
+// is none
+static inline void Hart_Wake_Clear(void)
+{
+  CLINT_REG(CLINT_MSIP + read_csr(mhartid) * CLINT_MSIP_size) = 0;
+  asm volatile ("fence" ::: "memory");
+}
+
+// Sleep until woken, or return at once if woken since Hart_Wake_Clear()
+static inline void Hart_Sleep(void)
+{
+  asm volatile ("wfi");
+}
 
 /********** Generic barrier **********/
 // everything zero is correct initial state
@@ -14,17 +42,20 @@ typedef struct Barrier {
   _Atomic volatile int entered[2];
   _Atomic volatile int wait[2];
   _Atomic volatile int gen;
+  _Atomic volatile unsigned long sleeping[2]; // harts to wake in each gen
 } Barrier;
 
 // This function is declared inline b/c it is in .h file
 static inline void Barrier_Wait(Barrier *bar, int numProcs) // re-write for C/C++11 atomics
 {
   int gen, arrived;
+  unsigned long hart = read_csr(mhartid);
 
   if (numProcs == 1)
     return;
 
   gen = bar->gen;       /* gen only changes when everyone is waiting */
+  atomic_fetch_or(&(bar->sleeping[gen]), 1UL << hart);
   // update number of threads arrived at barrier
   arrived = atomic_fetch_add(&(bar->entered[gen]), 1) + 1;
 
@@ -35,15 +66,32 @@ static inline void Barrier_Wait(Barrier *bar, int numProcs) // re-write for C/C+
 
     atomic_fetch_add(&(bar->entered[gen]), -1);
     if (arrived > 1) {
+      /* release the others before waking them, so a woken hart sees it */
+      unsigned long sleeping = atomic_exchange(&(bar->sleeping[gen]), 0) & ~(1UL << hart);
       bar->wait[gen] = 1;
+      asm volatile ("fence" ::: "memory");
+      for (int i = 0; sleeping; i++, sleeping >>= 1) {
+        if (sleeping & 1) Hart_Wake(i);
+      }
+      /* every wake-up is raised; a hart may now clear its own for good */
+      asm volatile ("fence" ::: "memory");
+      bar->wait[gen] = 2;
     }
   } else {
-    while (bar->wait[gen] == 0) ;
+    for (;;) {
+      Hart_Wake_Clear();
+      if (bar->wait[gen] != 0) break;
+      Hart_Sleep();
+    }
+    /* our wake-up may still be on its way; clear it once it has been raised */
+    while (bar->wait[gen] == 1) ;
+    Hart_Wake_Clear();
 
     if (atomic_fetch_add(&(bar->entered[gen]), -1) == 1) {
       bar->wait[gen] = 0;
    }
   }
+  Hart_Wake_Clear();
 }
 
 #endif
@@ -0,0 +1,66 @@
+/* Copyright (c) 2018 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/* See the file LICENSE for further information */
+
+#ifndef _SIFIVE_PDMA_H
+#define _SIFIVE_PDMA_H
+
+#define PDMA_CHANNELS 4
+
+/* Register offsets */
+#define PDMA_CHANNEL(n)       (0x80000 + (n) * 0x1000)
+#define PDMA_CONTROL          0x000
+#define PDMA_NEXT_CONFIG      0x004
+#define PDMA_NEXT_BYTES       0x008
+#define PDMA_NEXT_DESTINATION 0x010
+#define PDMA_NEXT_SOURCE      0x018
+
+/* Fields of CONTROL */
+#define PDMA_CONTROL_CLAIM    (1U << 0)
+#define PDMA_CONTROL_RUN      (1U << 1)
+#define PDMA_CONTROL_DONE     (1U << 30)
+#define PDMA_CONTROL_ERROR    (1U << 31)
+
+/* Fields of NEXT_CONFIG: log2 of the largest read and write transactions,
+   clamped by the channel to what it supports */
+#define PDMA_CONFIG_WSIZE(x)  ((x) << 24)
+#define PDMA_CONFIG_RSIZE(x)  ((x) << 28)
+#define PDMA_CONFIG_FULL_SPEED (PDMA_CONFIG_RSIZE(0xf) | PDMA_CONFIG_WSIZE(0xf))
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+
+static inline volatile uint32_t *pdma_control(uint64_t base_addr, int channel) {
+  return (volatile uint32_t *)(base_addr + PDMA_CHANNEL(channel) + PDMA_CONTROL);
+}
+
+// Claim the channel and copy bytes from source to destination
+static inline void pdma_start(uint64_t base_addr, int channel, uint64_t destination, uint64_t source, uint64_t bytes) {
+  uint64_t regs = base_addr + PDMA_CHANNEL(channel);
+  *pdma_control(base_addr, channel) = PDMA_CONTROL_CLAIM; // clears DONE and ERROR
+  *(volatile uint32_t *)(regs + PDMA_NEXT_CONFIG) = PDMA_CONFIG_FULL_SPEED;
+  *(volatile uint64_t *)(regs + PDMA_NEXT_BYTES) = bytes;
+  *(volatile uint64_t *)(regs + PDMA_NEXT_DESTINATION) = destination;
+  *(volatile uint64_t *)(regs + PDMA_NEXT_SOURCE) = source;
+  asm volatile ("fence w, o" : : : "memory");
+  *pdma_control(base_addr, channel) = PDMA_CONTROL_CLAIM | PDMA_CONTROL_RUN;
+}
+
+// Busy from pdma_start() until the transfer is done or has failed
+static inline int pdma_busy(uint64_t base_addr, int channel) {
+  return (*pdma_control(base_addr, channel) & (PDMA_CONTROL_DONE | PDMA_CONTROL_ERROR)) == 0;
+}
+
+static inline int pdma_error(uint64_t base_addr, int channel) {
+  return (*pdma_control(base_addr, channel) & PDMA_CONTROL_ERROR) != 0;
+}
+
+static inline void pdma_release(uint64_t base_addr, int channel) {
+  *pdma_control(base_addr, channel) = 0;
+}
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* _SIFIVE_PDMA_H */
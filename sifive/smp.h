@@ -22,6 +22,11 @@
 #define NONSMP_HART 0
 #endif
 
+// The hart that runs the FSBL boot flow once NONSMP_HART has the clocks up
+#ifndef BOOT_HART
+#define BOOT_HART (NUM_CORES - 1)
+#endif
+
 /* If your test cannot handle multiple-threads, use this: 
  *   smp_disable(reg1, reg2)
  */
@@ -0,0 +1,131 @@
+/* Copyright (c) 2018 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/* See the file LICENSE for further information */
+
+#ifndef SIFIVE_WORKQ
+#define SIFIVE_WORKQ
+
+#include <stdatomic.h>
+#include <sifive/barrier.h>
+
+/********** Work queue **********/
+// A bounded lock-free queue of tasks any hart may submit to and run from
+// (after Vyukov). Idle harts sleep in wfi and are woken when a task is
+// submitted or finishes.
+
+// Tasks the ring holds; a power of 2
+#ifndef WORKQ_SIZE
+#define WORKQ_SIZE 16
+#endif
+
+typedef void (*WorkQueue_Fn)(void *arg);
+
+// everything zero is correct initial state
+typedef struct WorkQueue {
+  struct {
+    // position this cell is next filled at, or taken at less one, minus
+    // the cell's index
+    _Atomic volatile unsigned int seq;
+    WorkQueue_Fn fn;
+    void *arg;
+    unsigned long harts;  // the harts that may run it, one bit each
+  } ring[WORKQ_SIZE];
+  _Atomic volatile unsigned int head;     // next position to take
+  _Atomic volatile unsigned int tail;     // next position to fill
+  _Atomic volatile unsigned int pending;  // submitted and not yet finished
+  _Atomic volatile unsigned long idle;    // harts to wake on any change
+} WorkQueue;
+
+static inline void WorkQueue_Wake(WorkQueue *q)
+{
+  unsigned long idle = atomic_exchange(&q->idle, 0);
+  for (int i = 0; idle; i++, idle >>= 1) {
+    if (idle & 1) Hart_Wake(i);
+  }
+}
+
+// Take the oldest task, if any and if this hart may run it, without running
+// it; tasks are taken in order, so one for other harts holds back the rest
+static inline int WorkQueue_Take(WorkQueue *q, unsigned long hart, WorkQueue_Fn *fn, void **arg)
+{
+  unsigned int pos = q->head;
+  for (;;) {
+    unsigned int i = pos % WORKQ_SIZE;
+    int dif = (int)(q->ring[i].seq + i - (pos + 1));
+    if (dif < 0) return 0;   // empty
+    if (dif == 0 && !(q->ring[i].harts & hart)) return 0;
+    if (dif == 0 && atomic_compare_exchange_weak(&q->head, &pos, pos + 1)) {
+      *fn = q->ring[i].fn;
+      *arg = q->ring[i].arg;
+      q->ring[i].seq = pos + WORKQ_SIZE - i;
+      return 1;
+    }
+    if (dif > 0) pos = q->head;
+  }
+}
+
+// Queue fn(arg) for one of the harts in a mask to run. If the ring is full,
+// runs it right away when this hart is in the mask, else waits for room.
+static inline void WorkQueue_Submit_Harts(WorkQueue *q, unsigned long harts, WorkQueue_Fn fn, void *arg)
+{
+  unsigned int pos = q->tail;
+  for (;;) {
+    unsigned int i = pos % WORKQ_SIZE;
+    int dif = (int)(q->ring[i].seq + i - pos);
+    if (dif < 0 && (harts & (1UL << read_csr(mhartid)))) break; // full
+    if (dif == 0 && atomic_compare_exchange_weak(&q->tail, &pos, pos + 1)) {
+      atomic_fetch_add(&q->pending, 1);
+      q->ring[i].fn = fn;
+      q->ring[i].arg = arg;
+      q->ring[i].harts = harts;
+      q->ring[i].seq = pos + 1 - i;
+      WorkQueue_Wake(q);
+      return;
+    }
+    if (dif != 0) pos = q->tail;
+  }
+  fn(arg);
+}
+
+// Queue fn(arg) for any hart to run
+static inline void WorkQueue_Submit(WorkQueue *q, WorkQueue_Fn fn, void *arg)
+{
+  WorkQueue_Submit_Harts(q, ~0UL, fn, arg);
+}
+
+// Run one queued task. Returns 0 if there was none, in which case this hart
+// is woken on the next change and may Hart_Sleep() once it has checked for
+// other work after Hart_Wake_Clear().
+static inline int WorkQueue_Run(WorkQueue *q)
+{
+  unsigned long hart = 1UL << read_csr(mhartid);
+  WorkQueue_Fn fn;
+  void *arg;
+
+  atomic_fetch_or(&q->idle, hart);
+  if (!WorkQueue_Take(q, hart, &fn, &arg)) return 0;
+  atomic_fetch_and(&q->idle, ~hart);
+  fn(arg);
+  atomic_fetch_sub(&q->pending, 1);
+  WorkQueue_Wake(q);
+  return 1;
+}
+
+// Wait until every task submitted, by any hart, has finished; running
+// queued tasks meanwhile if help is set
+static inline void WorkQueue_Wait_All(WorkQueue *q, int help)
+{
+  unsigned long hart = 1UL << read_csr(mhartid);
+
+  for (;;) {
+    Hart_Wake_Clear();
+    if (help && WorkQueue_Run(q)) continue;
+    atomic_fetch_or(&q->idle, hart);
+    if (!q->pending) break;
+    Hart_Sleep();
+  }
+  atomic_fetch_and(&q->idle, ~hart);
+}
+
+#endif
@@ -54,3 +54,14 @@ void uart_put_hex64(void *uartctrl, uint64_t hex){
   uart_put_hex(uartctrl,hex&0xFFFFFFFF);
 }
 
+void uart_put_dec(void* uartctrl, uint32_t dec) {
+  char digits[10];
+  int n = 0;
+  do {
+    digits[n++] = '0' + dec % 10;
+    dec /= 10;
+  } while (dec);
+  while (n > 0) {
+    uart_putc(uartctrl, digits[--n]);
+  }
+}
@@ -61,6 +61,10 @@
 #define ERROR_CODE_SD_CARD_CMD18 0xa
 #define ERROR_CODE_SD_CARD_CMD18_CRC 0xb
 #define ERROR_CODE_SD_CARD_UNEXPECTED_ERROR 0xc
+#define ERROR_CODE_GPT_PARTITION_TOO_SMALL 0xd
+#define ERROR_CODE_SD_CARD_CMD24 0xe
+#define ERROR_CODE_SD_CARD_CMD24_DATA 0xf
+#define ERROR_CODE_WRITE_UNSUPPORTED 0x10
 
 // We are assuming that an error LED is connected to the GPIO pin
 #define UX00BOOT_ERROR_LED_GPIO_PIN 15
@@ -270,7 +274,33 @@ static int decode_sd_copy_error(int error)
 }
 
 
-static int load_sd_gpt_partition(spi_ctrl* spictrl, void* dst, const gpt_guid* partition_type_guid)
+static int decode_sd_write_error(int error)
+{
+  switch (error) {
+    case SD_WRITE_ERROR_CMD24: return ERROR_CODE_SD_CARD_CMD24;
+    case SD_WRITE_ERROR_CMD24_DATA: return ERROR_CODE_SD_CARD_CMD24_DATA;
+    default: return ERROR_CODE_SD_CARD_UNEXPECTED_ERROR;
+  }
+}
+
+
+/**
+ * Number of blocks to transfer: the whole partition when size is 0, else size
+ * bytes rounded up to whole blocks.
+ */
+static int partition_blocks(gpt_partition_range range, size_t size, uint64_t* blocks)
+{
+  uint64_t available = range.last_lba + 1 - range.first_lba;
+  if (size == 0) {
+    *blocks = available;
+    return 0;
+  }
+  *blocks = (size + GPT_BLOCK_SIZE - 1) / GPT_BLOCK_SIZE;
+  return (*blocks > available) ? ERROR_CODE_GPT_PARTITION_TOO_SMALL : 0;
+}
+
+
+static int locate_sd_gpt_partition(spi_ctrl* spictrl, const gpt_guid* partition_type_guid, gpt_partition_range* range)
 {
   uint8_t gpt_buf[GPT_BLOCK_SIZE];
   int error;
@@ -295,18 +325,43 @@ static int load_sd_gpt_partition(spi_ctrl* spictrl, void* dst, const gpt_guid* p
   if (!gpt_is_valid_partition_range(part_range)) {
     return ERROR_CODE_GPT_PARTITION_NOT_FOUND;
   }
+  *range = part_range;
+  return 0;
+}
 
-  error = sd_copy(
-    spictrl,
-    dst,
-    part_range.first_lba,
-    part_range.last_lba + 1 - part_range.first_lba
-  );
+
+static int load_sd_gpt_partition(spi_ctrl* spictrl, void* dst, size_t size, const gpt_guid* partition_type_guid)
+{
+  gpt_partition_range range;
+  uint64_t blocks;
+  int error;
+
+  error = locate_sd_gpt_partition(spictrl, partition_type_guid, &range);
+  if (!error) error = partition_blocks(range, size, &blocks);
+  if (error) return error;
+
+  error = sd_copy(spictrl, dst, range.first_lba, blocks);
   if (error) return decode_sd_copy_error(error);
   return 0;
 }
 
 
+static int store_sd_gpt_partition(spi_ctrl* spictrl, const void* src, size_t size, const gpt_guid* partition_type_guid)
+{
+  gpt_partition_range range;
+  uint64_t blocks;
+  int error;
+
+  error = locate_sd_gpt_partition(spictrl, partition_type_guid, &range);
+  if (!error) error = partition_blocks(range, size, &blocks);
+  if (error) return error;
+
+  error = sd_write(spictrl, src, range.first_lba, blocks);
+  if (error) return decode_sd_write_error(error);
+  return 0;
+}
+
+
 //------------------------------------------------------------------------------
 // SPI flash
 //------------------------------------------------------------------------------
@@ -388,16 +443,20 @@ static gpt_partition_range find_mmap_gpt_partition(const void* gpt_base, const g
 /**
  * Load GPT partition from memory-mapped GPT image.
  */
-static int load_mmap_gpt_partition(const void* gpt_base, void* payload_dest, const gpt_guid* partition_type_guid)
+static int load_mmap_gpt_partition(const void* gpt_base, void* payload_dest, size_t size, const gpt_guid* partition_type_guid)
 {
   gpt_partition_range range = find_mmap_gpt_partition(gpt_base, partition_type_guid);
+  uint64_t blocks;
+  int error;
   if (!gpt_is_valid_partition_range(range)) {
     return ERROR_CODE_GPT_PARTITION_NOT_FOUND;
   }
+  error = partition_blocks(range, size, &blocks);
+  if (error) return error;
   memcpy(
     payload_dest,
     (void*) ((uintptr_t) gpt_base + range.first_lba * GPT_BLOCK_SIZE),
-    (range.last_lba + 1 - range.first_lba) * GPT_BLOCK_SIZE
+    blocks * GPT_BLOCK_SIZE
   );
   return 0;
 }
@@ -436,8 +495,9 @@ static gpt_partition_range find_spiflash_gpt_partition(
 /**
  * Load GPT partition from SPI flash.
  */
-static int load_spiflash_gpt_partition(spi_ctrl* spictrl, void* dst, const gpt_guid* partition_type_guid)
+static int load_spiflash_gpt_partition(spi_ctrl* spictrl, void* dst, size_t size, const gpt_guid* partition_type_guid)
 {
+  uint64_t blocks;
   uint8_t gpt_buf[GPT_BLOCK_SIZE];
   int error;
   error = spi_copy(spictrl, gpt_buf, GPT_HEADER_LBA * GPT_BLOCK_SIZE, GPT_HEADER_BYTES);
@@ -459,12 +519,14 @@ static int load_spiflash_gpt_partition(spi_ctrl* spictrl, void* dst, const gpt_g
   if (!gpt_is_valid_partition_range(part_range)) {
     return ERROR_CODE_GPT_PARTITION_NOT_FOUND;
   }
+  error = partition_blocks(part_range, size, &blocks);
+  if (error) return error;
 
   error = spi_copy(
     spictrl,
     dst,
     part_range.first_lba * GPT_BLOCK_SIZE,
-    (part_range.last_lba + 1 - part_range.first_lba) * GPT_BLOCK_SIZE
+    blocks * GPT_BLOCK_SIZE
   );
   if (error) return ERROR_CODE_SPI_COPY_FAILED;
   return 0;
@@ -473,7 +535,9 @@ static int load_spiflash_gpt_partition(spi_ctrl* spictrl, void* dst, const gpt_g
 
 void ux00boot_fail(long code, int trap)
 {
-  if (read_csr(mhartid) == NONSMP_HART) {
+  // Boot may run on any hart; the first to fail reports
+  static _Atomic int reported;
+  if (!atomic_exchange(&reported, 1)) {
     // Print error code to UART
     UART0_REG(UART_REG_TXCTRL) = UART_TXEN;
 
@@ -515,12 +579,13 @@ void ux00boot_fail(long code, int trap)
 //==============================================================================
 
 /**
- * Load GPT partition match specified partition type into specified memory.
+ * Read or write the GPT partition matching the specified partition type.
  *
- * Read from mode select device to determine which bulk storage medium to read
- * GPT image from, and properly initialize the bulk storage based on type.
+ * Read from mode select device to determine which bulk storage medium holds
+ * the GPT image, and properly initialize the bulk storage based on type.
+ * size 0 means the whole partition.
  */
-void ux00boot_load_gpt_partition(void* dst, const gpt_guid* partition_type_guid, unsigned int peripheral_input_khz)
+static int access_gpt_partition(void* buf, size_t size, int write, const gpt_guid* partition_type_guid, unsigned int peripheral_input_khz)
 {
   uint32_t mode_select = *((volatile uint32_t*) MODESELECT_MEM_ADDR);
 
@@ -547,35 +612,42 @@ void ux00boot_load_gpt_partition(void* dst, const gpt_guid* partition_type_guid,
       // MODESELECT_LOOP. Don't try to find spi device in debug mode.
       break;
     default:
-      ux00boot_fail(ERROR_CODE_UNHANDLED_SPI_DEVICE, 0);
-      break;
+      return ERROR_CODE_UNHANDLED_SPI_DEVICE;
   }
 
   unsigned int error = 0;
 
+  // Only SD cards can be written; SPI flash would need erase/program support
+  if (write && boot_routine != UX00BOOT_ROUTINE_SDCARD && boot_routine != UX00BOOT_ROUTINE_SDCARD_NO_INIT) {
+    return ERROR_CODE_WRITE_UNSUPPORTED;
+  }
+
   switch (boot_routine)
   {
     case UX00BOOT_ROUTINE_FLASH:
       error = initialize_spi_flash_direct(spictrl, peripheral_input_khz);
-      if (!error) error = load_spiflash_gpt_partition(spictrl, dst, partition_type_guid);
+      if (!error) error = load_spiflash_gpt_partition(spictrl, buf, size, partition_type_guid);
       break;
     case UX00BOOT_ROUTINE_MMAP:
       error = initialize_spi_flash_mmap_single(spictrl, peripheral_input_khz);
-      if (!error) error = load_mmap_gpt_partition(spimem, dst, partition_type_guid);
+      if (!error) error = load_mmap_gpt_partition(spimem, buf, size, partition_type_guid);
       break;
     case UX00BOOT_ROUTINE_MMAP_QUAD:
       error = initialize_spi_flash_mmap_quad(spictrl, peripheral_input_khz);
-      if (!error) error = load_mmap_gpt_partition(spimem, dst, partition_type_guid);
+      if (!error) error = load_mmap_gpt_partition(spimem, buf, size, partition_type_guid);
       break;
     case UX00BOOT_ROUTINE_SDCARD:
     case UX00BOOT_ROUTINE_SDCARD_NO_INIT:
       {
         int skip_sd_init_commands = (boot_routine == UX00BOOT_ROUTINE_SDCARD) ? 0 : 1;
         error = initialize_sd(spictrl, peripheral_input_khz, skip_sd_init_commands);
-        if (!error) error = load_sd_gpt_partition(spictrl, dst, partition_type_guid);
+        if (!error && write) error = store_sd_gpt_partition(spictrl, buf, size, partition_type_guid);
+        else if (!error) error = load_sd_gpt_partition(spictrl, buf, size, partition_type_guid);
       }
       break;
     case UX00BOOT_ROUTINE_LOOP:
+      // Only whole-partition loads are handed to the debugger
+      if (size) return ERROR_CODE_UNHANDLED_BOOT_ROUTINE;
       error = 0;
       /**
        * Control transfer back to debugger.
@@ -588,6 +660,40 @@ void ux00boot_load_gpt_partition(void* dst, const gpt_guid* partition_type_guid,
       break;
   }
 
+  return error;
+}
+
+/**
+ * Load GPT partition match specified partition type into specified memory.
+ * Returns an ERROR_CODE_* instead of failing, for optional partitions.
+ */
+int ux00boot_try_load_gpt_partition(void* dst, const gpt_guid* partition_type_guid, unsigned int peripheral_input_khz)
+{
+  return access_gpt_partition(dst, 0, 0, partition_type_guid, peripheral_input_khz);
+}
+
+/**
+ * Read the first size bytes of a GPT partition, rounded up to whole blocks;
+ * dst must have room for them.
+ */
+int ux00boot_try_read_gpt_partition(void* dst, size_t size, const gpt_guid* partition_type_guid, unsigned int peripheral_input_khz)
+{
+  return access_gpt_partition(dst, size, 0, partition_type_guid, peripheral_input_khz);
+}
+
+/**
+ * Write size bytes, rounded up to whole blocks, to the start of a GPT
+ * partition. Only SD cards are supported.
+ */
+int ux00boot_try_write_gpt_partition(const void* src, size_t size, const gpt_guid* partition_type_guid, unsigned int peripheral_input_khz)
+{
+  return access_gpt_partition((void*) src, size, 1, partition_type_guid, peripheral_input_khz);
+}
+
+void ux00boot_load_gpt_partition(void* dst, const gpt_guid* partition_type_guid, unsigned int peripheral_input_khz)
+{
+  int error = ux00boot_try_load_gpt_partition(dst, partition_type_guid, peripheral_input_khz);
+
   if (error) {
     ux00boot_fail(error, 0);
   }
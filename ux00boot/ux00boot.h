@@ -8,9 +8,19 @@
 
 #ifndef __ASSEMBLER__
 
+#include <stddef.h>
 #include <gpt/gpt.h>
 
+// Error codes the boot stages raise through ux00boot_fail() themselves,
+// numbered after the ones ux00boot.c uses
+#define ERROR_CODE_DDR_TRAINING_FAILED 0x11
+#define ERROR_CODE_CORE_PLL_LOCK 0x12
+#define ERROR_CODE_BOOT_STACK_OVERFLOW 0x13
+
 void ux00boot_load_gpt_partition(void* dst, const gpt_guid* partition_type_guid, unsigned int spi_clk_input_khz);
+int ux00boot_try_load_gpt_partition(void* dst, const gpt_guid* partition_type_guid, unsigned int spi_clk_input_khz);
+int ux00boot_try_read_gpt_partition(void* dst, size_t size, const gpt_guid* partition_type_guid, unsigned int spi_clk_input_khz);
+int ux00boot_try_write_gpt_partition(const void* src, size_t size, const gpt_guid* partition_type_guid, unsigned int spi_clk_input_khz);
 void ux00boot_fail(long code, int trap);
 
 #endif /* !__ASSEMBLER__ */
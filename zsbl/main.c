@@ -9,6 +9,7 @@
 #include <ux00boot/ux00boot.h>
 #include <gpt/gpt.h>
 #include "encoding.h"
+#include <clkutils/clkutils.h>
 
 
 static Barrier barrier;
@@ -17,6 +18,14 @@ extern const gpt_guid gpt_guid_sifive_fsbl;
 
 #define CORE_CLK_KHZ 33000
 
+// With ZSBL_COREPLL the core PLL is locked before the FSBL is loaded: 1GHz,
+// or 500MHz when tlclk runs at the core clock. The FSBL finds it running
+// and keeps it.
+#ifdef ZSBL_COREPLL
+  #define COREPLL_CLK_KHZ_1TO1 500000
+  #define COREPLL_CLK_KHZ_2TO1 1000000
+#endif
+
 
 void handle_trap(void)
 {
@@ -39,12 +48,31 @@ int main()
 {
   if (read_csr(mhartid) == NONSMP_HART) {
     unsigned int peripheral_input_khz;
+#ifdef ZSBL_COREPLL
+    // Scale the UART before the clock rises; the SPI divider is set up by
+    // ux00boot from peripheral_input_khz
+    if (UX00PRCI_REG(UX00PRCI_CLKMUXSTATUSREG) & CLKMUX_STATUS_TLCLKSEL) {
+      peripheral_input_khz = COREPLL_CLK_KHZ_1TO1; // perpheral_clk = tlclk
+      init_uart(peripheral_input_khz);
+      ux00prci_select_corepll_500MHz(&UX00PRCI_REG(UX00PRCI_CORECLKSELREG),
+                                     &UX00PRCI_REG(UX00PRCI_COREPLLCFG),
+                                     &UX00PRCI_REG(UX00PRCI_COREPLLOUT));
+    } else {
+      peripheral_input_khz = (COREPLL_CLK_KHZ_2TO1 / 2);
+      init_uart(peripheral_input_khz);
+      ux00prci_select_corepll_1GHz(&UX00PRCI_REG(UX00PRCI_CORECLKSELREG),
+                                   &UX00PRCI_REG(UX00PRCI_COREPLLCFG),
+                                   &UX00PRCI_REG(UX00PRCI_COREPLLOUT));
+    }
+#else
     if (UX00PRCI_REG(UX00PRCI_CLKMUXSTATUSREG) & CLKMUX_STATUS_TLCLKSEL) {
       peripheral_input_khz = CORE_CLK_KHZ; // perpheral_clk = tlclk
     } else {
       peripheral_input_khz = (CORE_CLK_KHZ / 2);
     }
     init_uart(peripheral_input_khz);
+#endif
+    clkutils_calibrate(); // for the SD card power-up delay
     ux00boot_load_gpt_partition((void*) CCACHE_SIDEBAND_ADDR, &gpt_guid_sifive_fsbl, peripheral_input_khz);
   }
 